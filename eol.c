@@ -22,16 +22,30 @@
     temporary file to the same name as the input file.  It does not make a
     backup copy of the input file.
 
+    With -i, the program converts the file in place instead, without a
+    temporary file.  This needs no extra disk space, but it is not atomic:
+    if the program is interrupted, the file is left partly converted.
+
  Scanning for end-of-line characters:
 
     When scanning for end-of-line characters, the program does not alter the
     input file.  The program reports the total number of line ends found and
     the number of line ends of each supported type found.
 
+ The library:
+
+    The line ends are set and counted by libeol (libeol.c and eol.h), which
+    keeps all the state of a conversion or a scan in a context, so it can
+    be used by other programs too.  The makefile builds it as libeol.a,
+    which this program is linked with, and as libeol.so.  eol.hpp has
+    header-only C++ classes over it.
+
  ------------------------------------------------------------------------------
  Usage:
 
-	eol [-?] [-v] [-d | -m | -u] [-s] [files]
+	eol [-?] [-v] [-d | -m | -u] [-i] [-s] [-j [N]] [-r] [--no-symlinks]
+	    [--follow-outside] [--one-file-system] [--max-depth=N]
+	    [--files-from=FILE [-0]] [--kernel=NAME] [--autotune] [files]
 
 	Argument        	Result
 	---------------		------------------------------------------------
@@ -40,7 +54,26 @@
 	-d              	Set DOS CR/LF end-of-line characters in files
 	-m              	Set Macintosh CR end-of-line character in files
 	-u              	Set UNIX LF end-of-line character in files
+	-i              	Set end-of-line characters in place, without a
+	                	temporary file (not atomic)
 	-s              	Scan and report end-of-line characters in files
+	-j [N]          	Process N files (1 to 64) at once, largest
+	                	first, or one file per CPU without N
+	--files-from=FILE	Also process the files named in FILE, one per
+	                	line, or in stdin for -
+	-0              	The names in the --files-from list end with NUL
+	-r              	Process the files in directories and their
+	                	subdirectories
+	--no-symlinks   	With -r, skip symbolic links to files
+	--follow-outside	With -r, also set the files that symbolic links
+	                	point to outside the directory
+	--one-file-system	With -r, skip directories on other filesystems
+	--max-depth=N   	With -r, skip files more than N levels down,
+	                	where a directory's own files are 1 level down
+	--kernel=NAME   	Use the scalar, runs, swar, sse2, avx2 or avx512
+	                	kernels
+	--autotune      	Measure and save the fastest kernels for short
+	                	and long lines
 	 files
 
 	Use the -s option to scan for end-of-line characters.
@@ -50,20 +83,204 @@
  ******************************************************************************
  */
 
+#ifdef __linux__
+#define _GNU_SOURCE         /* fallocate() */
+#endif /* __linux__ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <errno.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#ifdef MS_WIN32_COMPILER
+#include <io.h>
+#else
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <dirent.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif /* __linux__ */
+#define EOL_MMAP
+#define EOL_IN_PLACE
+#define EOL_THREADS
+#define EOL_OPENAT
+#define EOL_WALK
+#endif /* MS_WIN32_COMPILER */
+
+/* The conversion and counting of line ends, in libeol.c. */
+#include "eol.h"
+
+/* Files are opened relative to a directory where the system allows it. */
+#ifdef EOL_OPENAT
+#define EOL_CWD AT_FDCWD
+#else
+#define EOL_CWD 0
+#endif /* EOL_OPENAT */
+
+/* io_uring, used through its system calls when the kernel headers have it. */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#define EOL_URING
+#endif /* __has_include(<linux/io_uring.h>) */
+#endif /* __linux__ && __has_include */
+
+/*
+ Files are processed on several threads with -j, so the state of the file
+ being processed is kept per thread.
+ */
+#ifdef EOL_THREADS
+#define EOL_THREAD_LOCAL __thread
+#else
+#define EOL_THREAD_LOCAL
+#endif /* EOL_THREADS */
 
 /* Parse the commandline. */
 int parse_commandline(int argc, char *argv[]);
 
+/* Set or scan the EOL characters of one file, or of stdin. */
+int eol_file(char *fname);
+int eol_file_at(int dirfd, char *name, char *fname);
+int eol_stdin(void);
+FILE *open_at(int dirfd, char *name, char *mode);
+int rename_at(int dirfd, char *from, char *to);
+
+/* Process files on several threads, at most EOL_MAX_JOBS at once. */
+#define EOL_MAX_JOBS 64
+
+int eol_files(char **files, int n_files, int jobs);
+int parse_jobs(const char *s);
+
+/* Extension of the temporary output file of a file. */
+#define EOL_TEMP_EXTENSION ".EOL_TEMP_FILE"
+
+/* Longest name in a directory that -r processes. */
+#define EOL_NAME_MAX 256
+
+/* Process small files with batched io_uring system calls. */
+int uring_files(char **files, int n_files);
+
+/* Process the files in directory trees, with -r. */
+int walk_files(char **files, int n_files, int jobs);
+
+/* Process the files named in a list, with --files-from. */
+int stream_files(char *list_name, int delim, int jobs);
+
+/*
+ Reports.
+ Messages about a file go through report().  They are written to stderr,
+ which main() gives a buffer of EOL_REPORT_BUFFER bytes unless it is a
+ terminal, so the messages of a run go out in a few large writes.  While a
+ -j thread works on a file, its messages are collected in the report of
+ the file instead, and eol_files() writes the reports in command line
+ order.
+ */
+#define EOL_REPORT_BUFFER (64 * 1024)
+
+struct eol_report
+{
+    char *text;
+    size_t len;
+    size_t size;
+};
+
+void report(const char *format, ...);
+void report_scan(char *fname);
+
 /* Set EOL characters. */
-unsigned long set_eol();
+unsigned long set_eol(FILE *file_in, FILE *file_out, struct eol_counts *cnt);
 
 /* Scan for EOL characters. */
-unsigned long scan_eol();
+unsigned long scan_eol(FILE *file_in);
+
+/*
+ Block I/O.
+ The input is read with read() in blocks of EOL_BLOCK_SIZE bytes and the
+ output is written with write() one converted block at a time.  The output
+ block is twice the size of the input block, because every input byte can
+ become two output bytes (a lone CR or LF becomes CR+LF).
+ */
+#define EOL_BLOCK_SIZE (256 * 1024)
+
+int read_block(int fd, unsigned char *buf, size_t size);
+int write_block(int fd, const unsigned char *buf, size_t len);
+
+EOL_THREAD_LOCAL unsigned char block_in[EOL_BLOCK_SIZE];
+EOL_THREAD_LOCAL unsigned char block_out[EOL_MAX_OUTPUT(EOL_BLOCK_SIZE)];
+
+/* The kernels that set or scanned the file, named by libeol. */
+EOL_THREAD_LOCAL const char *kernel_used = 0;
+
+#ifdef EOL_MMAP
+/*
+ Memory-mapped input.
+ Regular files are scanned straight from a read-only mapping instead of
+ being copied into block_in.  Files larger than EOL_MAP_BUDGET bytes are
+ mapped one window of that size at a time.
+ */
+#define EOL_MAP_BUDGET (sizeof(void *) > 4 ? (size_t)1 << 30 : (size_t)64 << 20)
+
+/* A mapping of len bytes of a file, starting at data. */
+struct eol_map
+{
+    void *base;             /* page-aligned start of the mapping */
+    size_t base_len;        /* length of the mapping */
+    unsigned char *data;
+    size_t len;
+};
+
+int map_file(int fd, off_t offset, size_t len, int prot, struct eol_map *map);
+void unmap_file(struct eol_map *map);
+int allocate_file(int fd, off_t from, off_t to);
+int scan_mapped(int fd, struct eol_counts *cnt);
+#ifdef EOL_THREADS
+/*
+ Parallel scan and conversion.
+ A regular file of at least two chunks of EOL_CHUNK_SIZE bytes is scanned
+ or converted by up to one thread per online CPU, each taking the next
+ chunk that is left.
+ */
+#ifndef EOL_CHUNK_SIZE
+#define EOL_CHUNK_SIZE ((size_t)64 << 20)
+#endif /* EOL_CHUNK_SIZE */
+
+int scan_parallel(int fd, off_t start, off_t end, struct eol_counts *cnt);
+void forget_chunks(void);
+int set_parallel(int fd_in, off_t in_start, off_t in_end,
+                 int fd_out, off_t out_base, off_t out_end,
+                 int format, unsigned long *nl);
+#endif /* EOL_THREADS */
+int set_mapped(int fd_in, int fd_out, struct eol_counts *cnt,
+               unsigned long *nl);
+#endif /* EOL_MMAP */
+
+int prescan(FILE *file_in, struct eol_counts *cnt);
+
+/*
+ In-place conversion.
+ With -i, the line ends are set in the file itself instead of in a
+ temporary file that is renamed over it.  This needs no extra disk space,
+ but a crash part way through leaves a partly converted file.
+ */
+int set_eol_in_place(FILE *file, struct eol_counts *cnt, unsigned long *nl);
+#ifdef EOL_IN_PLACE
+int pread_block(int fd, unsigned char *buf, size_t size, off_t offset);
+int pwrite_block(int fd, const unsigned char *buf, size_t len, off_t offset);
+int shrink_in_place(int fd, unsigned long *nl);
+int expand_in_place(int fd, off_t size, struct eol_counts *cnt,
+                    unsigned long *nl);
+int substitute_in_place(int fd, off_t size, unsigned char from,
+                        unsigned char to);
+#endif /* EOL_IN_PLACE */
 
 /* Processes */
 enum EOL_OPERATIONS {EOL_NO_OPERATION, EOL_SET_OPERATION, EOL_SCAN_OPERATION};
@@ -71,8 +288,8 @@ char *operation_description[] = {"Invalid operation",
 								 "Set end-of-line characters",
                                  "Scan for end-of-line characters"};
 
-/* Output Formats */
-enum EOL_OUTPUT_FORMATS {EOL_NO_OUTPUT_FORMAT, EOL_UNIX_OUTPUT_FORMAT, EOL_MSDOS_OUTPUT_FORMAT, EOL_MAC_OUTPUT_FORMAT};
+/* Output Formats, numbered as in libeol */
+enum EOL_OUTPUT_FORMATS {EOL_NO_OUTPUT_FORMAT, EOL_UNIX_OUTPUT_FORMAT = EOL_UNIX, EOL_MSDOS_OUTPUT_FORMAT = EOL_MSDOS, EOL_MAC_OUTPUT_FORMAT = EOL_MAC};
 char *output_format_description[] = {"Invalid output format",
 									 "UNIX (LF)",
 									 "MS-DOS (CR+LF)",
@@ -81,13 +298,27 @@ char *output_format_description[] = {"Invalid output format",
 /* Global Variables */
 int operation = EOL_NO_OPERATION;
 int output_format = EOL_NO_OUTPUT_FORMAT;
-unsigned long cnt_eol;
-unsigned long cnt_msdos;
-unsigned long cnt_mac;
-unsigned long cnt_unix;
-double cnt_grand_total;
-FILE *file_in = 0;
-FILE *file_out = 0;
+int verbose = 0;
+int in_place = 0;
+
+/* Directory walk options. */
+int recursive = 0;
+int walk_symlinks = 1;          /* process symbolic links to files */
+int follow_outside = 0;         /* set files linked from outside the tree */
+int one_file_system = 0;        /* stay on the filesystem of each argument */
+int max_depth = -1;             /* deepest level of files, or -1 for all */
+
+/* Per thread: the counters are added up when the threads are done. */
+EOL_THREAD_LOCAL unsigned long cnt_eol;
+EOL_THREAD_LOCAL unsigned long cnt_msdos;
+EOL_THREAD_LOCAL unsigned long cnt_mac;
+EOL_THREAD_LOCAL unsigned long cnt_unix;
+EOL_THREAD_LOCAL double cnt_grand_total;
+EOL_THREAD_LOCAL FILE *file_in = 0;
+EOL_THREAD_LOCAL FILE *file_out = 0;
+EOL_THREAD_LOCAL int io_error = 0;
+EOL_THREAD_LOCAL struct eol_report *report_to = 0;
+char report_buffer[EOL_REPORT_BUFFER];
 
 /*
  ------------------------------------------------------------------------------
@@ -96,24 +327,42 @@ FILE *file_out = 0;
  */
 int main(int argc, char *argv[])
 {
-    int i, result;
+    int i, n;
     int err = 0;
-    int verbose = 0;
-    int argcnt = 1;
     char *pgm = 0;
-	char *fname = 0;
-    char eol_fname[512];
-    char *eolfextension = ".EOL_TEMP_FILE"; /* extension of temporary file */
+    char *kernel_name = 0;
+    int tune = 0;
+    int jobs = 1;
+    char **files;
+    int n_files = 0;
+    char *files_from = 0;
+    int list_delim = '\n';
 
     /* Set a pointer to the command name. */
 	pgm = argv[0];
 
+    /* Batch the messages into large writes, unless someone is watching. */
+    setvbuf(stderr, report_buffer, isatty(fileno(stderr)) ? _IOLBF : _IOFBF,
+            sizeof(report_buffer));
+
+    /* The arguments that are not options are the files. */
+    files = malloc((size_t)argc * sizeof(*files));
+    if(files == NULL)
+    {
+        fprintf(stderr, "Error: Out of memory.\n");
+        return 1;
+    }
+
     /* Process command-line options. */
     for(i = 1; i < argc; i++)
     {
-        if(argv[i][0] == '-' && argv[i][1] != '\0')
+        if(argv[i][0] != '-' || argv[i][1] == '\0')
+        {
+            /* A file, or - for stdin. */
+            files[n_files++] = argv[i];
+        }
+        else
         {
-            argcnt++;
             switch(argv[i][1])
             {
                 case 'd':
@@ -145,6 +394,91 @@ int main(int argc, char *argv[])
                     /* Verbose mode */
                     verbose++;
                     break;
+                case 'i':
+                case 'I':
+                    /* In place, without a temporary file */
+                    in_place = 1;
+                    break;
+                case '0':
+                    /* The file list is separated by NULs */
+                    list_delim = '\0';
+                    break;
+                case 'r':
+                case 'R':
+                    /* Recurse into directories */
+                    recursive = 1;
+                    break;
+                case 'j':
+                case 'J':
+                    /* Files processed at once: -jN, -j N, or -j for one per CPU */
+                    if(argv[i][2] != '\0')
+                    {
+                        if((jobs = parse_jobs(argv[i] + 2)) <= 0)
+                        {
+                            err++;
+                        }
+                    }
+                    else if(i + 1 < argc && (n = parse_jobs(argv[i + 1])) != 0)
+                    {
+                        /* A number is the count, anything else a file. */
+                        i++;
+                        if((jobs = n) < 0)
+                        {
+                            err++;
+                        }
+                    }
+                    else
+                    {
+#ifdef EOL_THREADS
+                        jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif /* EOL_THREADS */
+                        if(jobs > EOL_MAX_JOBS)
+                        {
+                            jobs = EOL_MAX_JOBS;
+                        }
+                    }
+                    if(jobs < 1)
+                    {
+                        jobs = 1;
+                    }
+                    break;
+                case '-':
+                    /* Long options */
+                    if(strncmp(argv[i], "--kernel=", 9) == 0)
+                    {
+                        kernel_name = argv[i] + 9;
+                    }
+                    else if(strcmp(argv[i], "--autotune") == 0)
+                    {
+                        tune = 1;
+                    }
+                    else if(strncmp(argv[i], "--files-from=", 13) == 0 &&
+                            argv[i][13] != '\0')
+                    {
+                        files_from = argv[i] + 13;
+                    }
+                    else if(strcmp(argv[i], "--no-symlinks") == 0)
+                    {
+                        walk_symlinks = 0;
+                    }
+                    else if(strcmp(argv[i], "--follow-outside") == 0)
+                    {
+                        follow_outside = 1;
+                    }
+                    else if(strcmp(argv[i], "--one-file-system") == 0)
+                    {
+                        one_file_system = 1;
+                    }
+                    else if(strncmp(argv[i], "--max-depth=", 12) == 0 &&
+                            isdigit((unsigned char)argv[i][12]))
+                    {
+                        max_depth = atoi(argv[i] + 12);
+                    }
+                    else
+                    {
+                        err++;
+                    }
+                    break;
                 default:
                     /* Treat all other options as an error. */
                     err++;
@@ -154,6 +488,41 @@ int main(int argc, char *argv[])
     }
     /* End of for loop processing each commandline argument. */
 
+    /* Choose the kernels: the named ones, or the fastest this CPU supports. */
+    if(eol_select_kernels(kernel_name) != 0)
+    {
+        fprintf(stderr,
+                "Error: Kernel %s is unknown or not supported by this CPU.\n"
+                "       Kernels:",
+                kernel_name);
+        for(i = 0; eol_kernel_list(i) != 0; i++)
+        {
+            fprintf(stderr, " %s", eol_kernel_list(i));
+        }
+        fprintf(stderr, "\n");
+        return 1;
+    }
+
+    /*
+     Use the measured thresholds for the kernels, or measure them now.
+     With --autotune and no operation, only measure.
+     */
+    if(tune)
+    {
+        if(eol_autotune(eol_tuning_path()) != 0)
+        {
+            return 1;
+        }
+        if(!err && operation == EOL_NO_OPERATION)
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        eol_load_tuning(eol_tuning_path());
+    }
+
 	/*
 	 Show the usage message if:
 	 	an invalid command line option was found, or
@@ -167,18 +536,49 @@ int main(int argc, char *argv[])
                 "This program will either set the end-of-line characters\n"
                 "in files or scan for end-of-line characters in files.\n"
                 "\n"
-                "Usage: %s [-d | -m | -u] [-s] [-v] [-?] [files]\n"
+                "Usage: %s [-d | -m | -u] [-i] [-s] [-v] [-j [N]] [-r] [--no-symlinks]\n"
+                "       [--follow-outside] [--one-file-system] [--max-depth=N]\n"
+                "       [--files-from=FILE [-0]] [--kernel=NAME] [--autotune] [-?]\n"
+                "       [files]\n"
                 "\n"
                 "Output format options:\n"
                 "  -d    set %s end-of-line characters,\n"
                 "  -m    set %s end-of-line characters,\n"
                 "  -u    set %s end-of-line characters.\n"
                 "  If multiple formats are specified, the last one is used.\n"
+                "  -i    set them in the files themselves, without temporary\n"
+                "        files.  This is not atomic: a crash can leave a file\n"
+                "        partly converted.\n"
                 "\n"
                 "Use -s to scan for end-of-line characters.\n"
                 "  Scan does not change the end-of-line, it reads the files\n"
                 "  and reports which end-of-line characters were found.\n"
                 "Use -v or -V to produce verbose messages.\n"
+                "Use -j N to process N files at once (1 to 64), largest first,\n"
+                "  or -j for one file per CPU.  The messages keep the command\n"
+                "  line order unless more than a megabyte of them waits for\n"
+                "  an earlier file, when a note says they no longer do.\n"
+                "Use --files-from=FILE to also process the files named in\n"
+                "  FILE, one per line, or - for stdin.  Use -0 if the names\n"
+                "  end with NUL characters instead, as from find -print0 or\n"
+                "  git ls-files -z.\n"
+                "Use -r to process the files in directories and their\n"
+                "  subdirectories.  A file reached through a symbolic link is\n"
+                "  set where the link points, and the link is kept.  With -r:\n"
+                "  --no-symlinks      skips symbolic links to files,\n"
+                "  --follow-outside   also sets the files that symbolic links\n"
+                "                     point to outside the directory, which\n"
+                "                     are skipped otherwise,\n"
+                "  --one-file-system  skips directories on other filesystems,\n"
+                "  --max-depth=N      skips files more than N levels down;\n"
+                "                     the files of the directory itself are\n"
+                "                     1 level down.\n"
+                "Use --kernel=NAME to use the scalar, runs, swar, sse2, avx2\n"
+                "  or avx512 kernels instead of the fastest ones this CPU\n"
+                "  supports.\n"
+                "Use --autotune to measure which kernels are fastest for\n"
+                "  short and long lines on this machine, and save the\n"
+                "  results in $EOL_AUTOTUNE_FILE or $HOME/.eol_autotune.\n"
                 "\n",
                 pgm,
                 output_format_description[EOL_MSDOS_OUTPUT_FORMAT],
@@ -192,450 +592,3905 @@ int main(int argc, char *argv[])
     {
         fprintf(stderr, "\nOperation: %s.\n",
                         operation_description[operation]);
+        fprintf(stderr, "Kernel: %s.\n", eol_selected_kernels());
     }
 
 	 cnt_grand_total = 0L;
 
     /* If no files were specified on the command line, use stdin. */
-    if (argcnt == argc)
+    if (n_files == 0 && files_from == 0)
     {
-        if(operation == EOL_SET_OPERATION)
-        {
-            if (verbose)
-            {
-                fprintf(stderr,
-                        "\nstdin: Setting %s end-of-line characters.\n",
-                        output_format_description[output_format]);
-            }
-
-			file_in = stdin;
-			file_out = stdout;
-            cnt_eol = set_eol();
+        free(files);
+        return eol_stdin();
+    }
 
-            if (verbose)
-            {
-                fprintf(stderr, "stdin: Processed %lu line ends.\n", cnt_eol);
-            }
+    /* Process end-of-line for each file given on the command line. */
+    if(recursive)
+    {
+        if(walk_files(files, n_files, jobs) != 0)
+        {
+            err = 1;
         }
-        else if(operation == EOL_SCAN_OPERATION)
+    }
+    else
+#ifdef EOL_THREADS
+    if(jobs > 1 && n_files > 1)
+    {
+        if(eol_files(files, n_files, jobs) != 0)
         {
-            if (verbose)
-            {
-                fprintf(stderr,
-                        "\nstdin: Scanning for end-of-line characters.\n");
-            }
-
-            cnt_msdos = 0L;
-            cnt_mac = 0L;
-            cnt_unix = 0L;
-			file_in = stdin;
-			cnt_eol = scan_eol();
-			cnt_grand_total += cnt_eol;
-
-            fprintf(stderr, "stdin: Found %lu total line ends.\n", cnt_eol);
-
-            if(cnt_msdos > 0L)
-            {
-                fprintf(stderr, "stdin:       %lu %s line ends.\n",
-                                cnt_msdos,
-                                output_format_description[EOL_MSDOS_OUTPUT_FORMAT]);
-            }
-            if(cnt_mac > 0L)
-            {
-                fprintf(stderr, "stdin:       %lu %s line ends.\n",
-                                cnt_mac,
-                                output_format_description[EOL_MAC_OUTPUT_FORMAT]);
-            }
-            if(cnt_unix > 0L)
-            {
-                fprintf(stderr, "stdin:       %lu %s line ends.\n",
-                                cnt_unix,
-                                output_format_description[EOL_UNIX_OUTPUT_FORMAT]);
-            }
+            err = 1;
         }
-        else
+    }
+    else
+#endif /* EOL_THREADS */
+#ifdef EOL_URING
+    if(n_files > 1 && !(operation == EOL_SET_OPERATION && in_place) &&
+       (i = uring_files(files, n_files)) >= 0)
+    {
+        if(i != 0)
         {
-            /* Bad operation - do nothing. */
+            err = 1;
         }
-
-        return 0;
     }
-	 /* End if processing stdin with no files on commandline. */
-
-    /* Process end-of-line for each file given on the command line. */
-    for(i = 1; i < argc; i++)
+    else
+#endif /* EOL_URING */
     {
-        /* ignore any args with leading '-', they are options */
-        if (argv[i][0] != '-')
+        for(i = 0; i < n_files; i++)
         {
-            /* Store the input filename. */
-            fname = argv[i];
-
-            /* Open the input file. */
-            file_in = fopen(fname, "rb");
-            if (file_in == NULL)
+            if(eol_file(files[i]) != 0)
             {
-                fprintf(stderr,
-                        "Error: Cannot open input file %s.\n"
-                        "       Reason: %s.\n",
-                        fname, strerror(errno));
                 err = 1;
-                continue;
-			   }
-
-            if(operation == EOL_SET_OPERATION)
-            {
-                /* Create and store the temporary output filename. */
-                strcpy(eol_fname, fname);
-                strcat(eol_fname, eolfextension);
-
-                /* Open the output file. */
-                file_out = fopen(eol_fname, "wb");
-                if (file_out == NULL)
-                {
-                    fprintf(stderr,
-                            "Error: Cannot open temporary output file %s.\n"
-                            "       Reason: %s.\n",
-                            eol_fname, strerror(errno));
-                    err = 1;
-                    continue;
-                }
             }
         }
+    }
+    /* End of loop processing each file. */
 
-        if ((argv[i][0] == '-' && argv[i][1] == '\0') ||
-            (argv[i][0] != '-'))
-        {
-            if(operation == EOL_SET_OPERATION)
-            {
-                if (verbose)
-                {
-                    fprintf(stderr,
-                            "\n%s: Setting %s end-of-line characters.\n",
-                            fname, output_format_description[output_format]);
-                }
+    /* Then the files named in the list, as the names arrive. */
+    if(files_from != 0 && stream_files(files_from, list_delim, jobs) != 0)
+    {
+        err = 1;
+    }
 
-                cnt_eol = set_eol(file_in, file_out);
+    free(files);
 
-                if (verbose)
-                {
-                    fprintf(stderr,
-                            "%s: Processed %lu line ends.\n",
-                            fname, cnt_eol);
-                }
-            }
-            else if(operation == EOL_SCAN_OPERATION)
-            {
-                if (verbose)
-                {
-                    fprintf(stderr,
-                            "\n%s: Scanning for end-of-line characters.\n",
-                            fname);
-                }
+    if(cnt_grand_total > 0L)
+    {
+      fprintf(stderr, "Grand Total:       %g line ends.\n",
+         cnt_grand_total);
+    }
+    
+    /* Return the number of errors as the exit code to the OS. */
+    return err;
+}
 
-                cnt_msdos = 0L;
-                cnt_mac = 0L;
-                cnt_unix = 0L;
-                cnt_eol = scan_eol(file_in);
-					 cnt_grand_total += cnt_eol;
+/*
+ ------------------------------------------------------------------------------
+ parse_jobs() - Read the number of files to process at once.
 
-                fprintf(stderr, "%s: Found %lu total line ends.\n",
-                                fname, cnt_eol);
+    Returns the number, 0 if s is not a number, or -1 if it is not from 1
+    to EOL_MAX_JOBS.
+ ------------------------------------------------------------------------------
+ */
 
-                if(cnt_msdos > 0L)
-                {
-                    fprintf(stderr, "%s:       %lu %s line ends.\n",
-                                    fname,
-                                    cnt_msdos,
-                                    output_format_description[EOL_MSDOS_OUTPUT_FORMAT]);
-                }
-                if(cnt_mac > 0L)
-                {
-                    fprintf(stderr, "%s:       %lu %s line ends.\n",
-                                    fname,
-                                    cnt_mac,
-                                    output_format_description[EOL_MAC_OUTPUT_FORMAT]);
-                }
-                if(cnt_unix > 0L)
-                {
-                    fprintf(stderr, "%s:       %lu %s line ends.\n",
-                                    fname,
-                                    cnt_unix,
-                                    output_format_description[EOL_UNIX_OUTPUT_FORMAT]);
-                }
-            }
-            else
-            {
-                /* Bad operation - do nothing. */
-            }
+int parse_jobs(const char *s)
+{
+    char *end;
+    long n;
 
-            /* Close files and rename output. */
-            if (file_in != stdin)
-            {
-                fclose(file_in);
+    if(!isdigit((unsigned char)*s))
+    {
+        return 0;
+    }
 
-                if(operation == EOL_SET_OPERATION)
-                {
-                    if (file_out != stdout)
-                    {
-                        fclose(file_out);
-                    }
+    errno = 0;
+    n = strtol(s, &end, 10);
+    if(*end != '\0')
+    {
+        return 0;
+    }
 
-                    /* Initialize the result variable. */
+    if(errno != 0 || n < 1 || n > EOL_MAX_JOBS)
+    {
+        return -1;
+    }
 
-                    result = 0;
+    return (int)n;
+}
 
-#ifdef MS_WIN32_COMPILER
+/*
+ ------------------------------------------------------------------------------
+ report() - Write a message about the file being processed.
 
-                    /*
-                     The rename() function only works in MS VC++ if the new
-                     filename doesn't already exist.
-                     In VC++, must remove() the original file first, then
-                     rename() the temporary file.
-                     */
+    Takes the arguments of printf().  The message goes to the report of the
+    file if this thread collects one, or to stderr.
+ ------------------------------------------------------------------------------
+ */
 
-                    if(result == 0)
-                        result = remove(fname);
+void report(const char *format, ...)
+{
+    struct eol_report *r = report_to;
+    va_list args;
+    char *text;
+    size_t size;
+    int n;
 
-                    if(result != 0)
-                    {
-                        fprintf(stderr, "remove() return: %d\n", result);
-                        fprintf(stderr,
-                                "Error: Cannot remove original file %s.\n"
-                                "       Reason: %s\n",
-                                fname, strerror(errno));
-                    }
+    if(r != 0)
+    {
+        va_start(args, format);
+        n = vsnprintf(r->text ? r->text + r->len : 0,
+                      r->text ? r->size - r->len : 0, format, args);
+        va_end(args);
 
-#endif /* MS_WIN32_COMPILER */
+        if(n >= 0 && r->len + (size_t)n < r->size)
+        {
+            r->len += (size_t)n;
+            return;
+        }
 
-                    /*
-                     The rename() function works in GNU C++, but the error
-                     handling logic below does not work for GNU C++.  The
-                     rename() function in GNU C++ returns non-zero, indicating
-                     that an error occurred, even though the file gets renamed
-                     correctly.
-                     */
+        size = 2 * r->size + (size_t)n + 1;
+        if(n >= 0 && (text = realloc(r->text, size)) != NULL)
+        {
+            r->text = text;
+            r->size = size;
 
-                    if(result == 0)
-                        result = rename(eol_fname, fname);
+            va_start(args, format);
+            vsnprintf(r->text + r->len, r->size - r->len, format, args);
+            va_end(args);
+            r->len += (size_t)n;
+            return;
+        }
+    }
 
-#ifndef GNU_WIN32_COMPILER
+    /* Not collected, or no memory to collect it: write it now. */
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+}
 
-					/* Check the result of renaming the temporary file. */
+/*
+ ------------------------------------------------------------------------------
+ report_scan() - Report the line ends a scan of one file found.
 
-                    if(result != 0)
-                    {
-                        fprintf(stderr, "rename() return: %d\n", result);
-                        fprintf(stderr,
-                                "Error: Cannot rename temporary output %s\n"
-                                "       to the original input name %s.\n"
-                                "       Reason: %s\n",
-                                eol_fname, fname, strerror(errno));
-                    }
+    The counts are in cnt_eol, cnt_msdos, cnt_mac and cnt_unix.
+ ------------------------------------------------------------------------------
+ */
 
-#endif /* #ifndef GNU_WIN32_COMPILER */
+void report_scan(char *fname)
+{
+    report("%s: Found %lu total line ends.\n", fname, cnt_eol);
 
-                }
-            }
-        }
+    if(cnt_msdos > 0L)
+    {
+        report("%s:       %lu %s line ends.\n",
+               fname,
+               cnt_msdos,
+               output_format_description[EOL_MSDOS_OUTPUT_FORMAT]);
     }
-    /* End of for loop processing each commandline argument. */
-
-    if(cnt_grand_total > 0L)
+    if(cnt_mac > 0L)
     {
-      fprintf(stderr, "Grand Total:       %g line ends.\n",
-         cnt_grand_total);
+        report("%s:       %lu %s line ends.\n",
+               fname,
+               cnt_mac,
+               output_format_description[EOL_MAC_OUTPUT_FORMAT]);
+    }
+    if(cnt_unix > 0L)
+    {
+        report("%s:       %lu %s line ends.\n",
+               fname,
+               cnt_unix,
+               output_format_description[EOL_UNIX_OUTPUT_FORMAT]);
     }
-    
-    /* Return the number of errors as the exit code to the OS. */
-    return err;
 }
 
 /*
  ------------------------------------------------------------------------------
- set_eol() - Set EOL characters.
+ eol_stdin() - Set EOL characters from stdin to stdout, or scan stdin.
 
-    IN     FMT                      OUT         Eat
-    --     ---                      ---         ---
-    CR     EOL_MSDOS_OUTPUT_FORMAT  CR + LF     single LF after the CR, if any
-    CR     EOL_MAC_OUTPUT_FORMAT    CR          single LF after the CR, if any
-    CR     EOL_UNIX_OUTPUT_FORMAT   LF          single LF after the CR, if any
-    LF     EOL_MSDOS_OUTPUT_FORMAT  CR + LF     nothing
-    LF     EOL_MAC_OUTPUT_FORMAT    CR          nothing
-    LF     EOL_UNIX_OUTPUT_FORMAT   LF          nothing
+    Returns 0, or 1 if stdin could not be completely read or written.
  ------------------------------------------------------------------------------
  */
 
-unsigned long set_eol(FILE *file_in, FILE *file_out)
+int eol_stdin(void)
 {
-    int ch;
-    const int ch_CR = '\r';
-    const int ch_LF = '\n';
-    unsigned long nl;
+    if(operation == EOL_SET_OPERATION)
+    {
+        if (verbose)
+        {
+            report("\nstdin: Setting %s end-of-line characters.\n",
+                   output_format_description[output_format]);
+        }
 
-    nl = 0L;
+		file_in = stdin;
+		file_out = stdout;
+        cnt_eol = set_eol(file_in, file_out, 0);
 
-    /* Read the file one character at a time. */
-    while((ch = getc(file_in)) != EOF)
+        if (verbose)
+        {
+            report("stdin: Processed %lu line ends with %s kernels.\n",
+                   cnt_eol,
+                   kernel_used ? kernel_used : eol_selected_kernels());
+        }
+    }
+    else if(operation == EOL_SCAN_OPERATION)
     {
-        /* Process the character. */
-        if(ch == ch_CR)
+        if (verbose)
         {
-            /* CR.  Could be CR alone, or CR followed by LF. */
-
-            /* Count the line. */
-            nl++;
+            report("\nstdin: Scanning for end-of-line characters.\n");
+        }
 
-            switch(output_format)
-            {
-                case EOL_MSDOS_OUTPUT_FORMAT:
-                    putc(ch_CR, file_out);
-                    putc(ch_LF, file_out);
-                    break;
-                case EOL_MAC_OUTPUT_FORMAT:
-                    putc(ch_CR, file_out);
-                    break;
-                case EOL_UNIX_OUTPUT_FORMAT:
-                    putc(ch_LF, file_out);
-                    break;
-                default:
-                    /* shouldn't happen - output the input character */
-                    putc(ch, file_out);
-                    break;
-            }
+        cnt_msdos = 0L;
+        cnt_mac = 0L;
+        cnt_unix = 0L;
+		file_in = stdin;
+		cnt_eol = scan_eol(file_in);
+		cnt_grand_total += cnt_eol;
 
-            /* See if the character was CR alone, or CR followed by LF. */
+        report_scan("stdin");
+    }
+    else
+    {
+        /* Bad operation - do nothing. */
+    }
 
-            /* Read the next character after the CR. */
-            ch = getc(file_in);
+    if(io_error)
+    {
+        io_error = 0;
+        return 1;
+    }
 
-            /* See what it is. Must eat a LF following a CR. */
-            if(ch == ch_LF)
-            {
-                /* LF after CR: Eat it. */
-            }
-            else if(ch == EOF)
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_file() - Set or scan the EOL characters of one file.
+
+    fname - is stdin.  The line ends are counted in cnt_grand_total of the
+    calling thread.  Returns 0, or 1 on error.
+ ------------------------------------------------------------------------------
+ */
+
+int eol_file(char *fname)
+{
+    if(strcmp(fname, "-") == 0)
+    {
+        return eol_stdin();
+    }
+
+    return eol_file_at(EOL_CWD, fname, fname);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_file_at() - Set or scan the EOL characters of a file in a directory.
+
+    name is relative to the open directory dirfd, and fname is the name of
+    the file in messages.  The temporary file is made and renamed in the
+    same directory.
+ ------------------------------------------------------------------------------
+ */
+
+int eol_file_at(int dirfd, char *name, char *fname)
+{
+    int result;
+    int err = 0;
+    char eol_name[512];
+    char *eolfextension = EOL_TEMP_EXTENSION; /* extension of temporary file */
+    int have_cnt = 0;
+    struct eol_counts cnt;
+    FILE *file_rw;
+
+    /* Open the input file. */
+    file_in = open_at(dirfd, name, "rb");
+    if (file_in == NULL)
+    {
+        report("Error: Cannot open input file %s.\n"
+               "       Reason: %s.\n",
+               fname, strerror(errno));
+        return 1;
+    }
+
+    if(operation == EOL_SET_OPERATION)
+    {
+        /* Leave a file that already has these line ends alone. */
+        have_cnt = (prescan(file_in, &cnt) == 0);
+        if(have_cnt && eol_conforming(output_format, &cnt))
+        {
+            if (verbose)
             {
-                /* EOF: Break from the read loop. Finished this file. */
-                break;
+                report("\n%s: Already conforming to %s end-of-line characters.\n"
+                       "%s: Left unchanged, %lu line ends.\n",
+                       fname, output_format_description[output_format],
+                       fname,
+                       cnt.cnt_msdos + cnt.cnt_mac + cnt.cnt_unix);
             }
-            else
+            fclose(file_in);
+            return 0;
+        }
+
+        /*
+         Set the line ends in the file itself, if asked to.  It is opened
+         for writing only now that it needs converting, so a read-only file
+         that conforms already is not an error.
+         */
+        if(in_place && (file_rw = open_at(dirfd, name, "r+b")) == NULL)
+        {
+            if (verbose)
             {
-                /* Other: Put it back so the next read loop will get it. */
-                ungetc(ch, file_in);
+                report("\n%s: Cannot open for writing (%s), "
+                       "using a temporary file.\n",
+                       fname, strerror(errno));
             }
         }
-        else if(ch == ch_LF)
+        else if(in_place)
         {
-            /* LF. */
+            if (verbose)
+            {
+                report("\n%s: Setting %s end-of-line characters in place.\n",
+                       fname, output_format_description[output_format]);
+            }
 
-            /* Count the line. */
-            nl++;
+            if(set_eol_in_place(file_rw, have_cnt ? &cnt : 0,
+                                &cnt_eol) == 0)
+            {
+                if(io_error)
+                {
+                    report("Error: %s may be partly converted.\n",
+                           fname);
+                    err = 1;
+                    io_error = 0;
+                }
+                else if (verbose)
+                {
+                    report("%s: Processed %lu line ends with %s kernels.\n",
+                           fname, cnt_eol,
+                           kernel_used ? kernel_used : eol_selected_kernels());
+                }
+                fclose(file_rw);
+                fclose(file_in);
+                return err;
+            }
+            fclose(file_rw);
 
-            switch(output_format)
+            if (verbose)
             {
-                case EOL_MSDOS_OUTPUT_FORMAT:
-                    putc(ch_CR, file_out);
-                    putc(ch_LF, file_out);
-                    break;
-                case EOL_MAC_OUTPUT_FORMAT:
-                    putc(ch_CR, file_out);
-                    break;
-                case EOL_UNIX_OUTPUT_FORMAT:
-                    putc(ch_LF, file_out);
-                    break;
-                default:
-                    /* shouldn't happen - output the input character */
-                    putc(ch, file_out);
-                    break;
+                report("%s: Cannot set these line ends in place, "
+                       "using a temporary file.\n",
+                       fname);
             }
         }
-        else
+
+        /*
+         Create and store the temporary output filename.  In messages it is
+         fname followed by the extension, however deep fname is.
+         */
+        if(strlen(name) + strlen(eolfextension) >= sizeof(eol_name))
+        {
+            report("Error: Cannot open temporary output file %s%s.\n"
+                   "       Reason: %s.\n",
+                   fname, eolfextension, strerror(ENAMETOOLONG));
+            fclose(file_in);
+            return 1;
+        }
+        strcpy(eol_name, name);
+        strcat(eol_name, eolfextension);
+
+        /* Open the output file. */
+        file_out = open_at(dirfd, eol_name, "w+b");
+        if (file_out == NULL)
         {
-            /* Regular character.  Just write it. */
-            putc(ch, file_out);
+            report("Error: Cannot open temporary output file %s%s.\n"
+                   "       Reason: %s.\n",
+                   fname, eolfextension, strerror(errno));
+            fclose(file_in);
+            return 1;
+        }
+
+        if (verbose)
+        {
+            report("\n%s: Setting %s end-of-line characters.\n",
+                   fname, output_format_description[output_format]);
+        }
+
+        cnt_eol = set_eol(file_in, file_out, have_cnt ? &cnt : 0);
+
+        if (verbose)
+        {
+            report("%s: Processed %lu line ends with %s kernels.\n",
+                   fname, cnt_eol,
+                   kernel_used ? kernel_used : eol_selected_kernels());
         }
     }
-    /* End of while loop reading input file. */
+    else if(operation == EOL_SCAN_OPERATION)
+    {
+        if (verbose)
+        {
+            report("\n%s: Scanning for end-of-line characters.\n",
+                   fname);
+        }
 
-    /* Return the number of end-of-lines processed. */
-    return nl;
+        cnt_msdos = 0L;
+        cnt_mac = 0L;
+        cnt_unix = 0L;
+        cnt_eol = scan_eol(file_in);
+        cnt_grand_total += cnt_eol;
+
+        report_scan(fname);
+
+        /* The counts are of the part of the file that could be read. */
+        if(io_error)
+        {
+            report("Error: %s was not read completely.\n", fname);
+            err = 1;
+            io_error = 0;
+        }
+    }
+    else
+    {
+        /* Bad operation - do nothing. */
+    }
+
+    /* Close files and rename output. */
+    fclose(file_in);
+
+    if(operation == EOL_SET_OPERATION)
+    {
+        fclose(file_out);
+
+        /* Initialize the result variable. */
+
+        result = 0;
+
+        /*
+         Do not replace the original file with a temporary file
+         that could not be completely read or written.
+         */
+
+        if(io_error)
+        {
+            report("Error: %s was not changed.\n"
+                   "       Temporary output left in %s%s.\n",
+                   fname, fname, eolfextension);
+            result = -1;
+            err = 1;
+            io_error = 0;
+        }
+
+#ifdef MS_WIN32_COMPILER
+
+        /*
+         The rename() function only works in MS VC++ if the new
+         filename doesn't already exist.
+         In VC++, must remove() the original file first, then
+         rename() the temporary file.
+         */
+
+        if(result == 0)
+            result = remove(name);
+
+        if(result != 0)
+        {
+            report("remove() return: %d\n", result);
+            report("Error: Cannot remove original file %s.\n"
+                   "       Reason: %s\n",
+                   fname, strerror(errno));
+        }
+
+#endif /* MS_WIN32_COMPILER */
+
+        /*
+         The rename() function works in GNU C++, but the error
+         handling logic below does not work for GNU C++.  The
+         rename() function in GNU C++ returns non-zero, indicating
+         that an error occurred, even though the file gets renamed
+         correctly.
+         */
+
+        if(result == 0)
+            result = rename_at(dirfd, eol_name, name);
+
+#ifndef GNU_WIN32_COMPILER
+
+		/* Check the result of renaming the temporary file. */
+
+        if(result != 0)
+        {
+            report("rename() return: %d\n", result);
+            report("Error: Cannot rename temporary output %s%s\n"
+                   "       to the original input name %s.\n"
+                   "       Reason: %s\n",
+                   fname, eolfextension, fname, strerror(errno));
+        }
+
+#endif /* #ifndef GNU_WIN32_COMPILER */
+
+    }
+
+    return err;
 }
 
 /*
  ------------------------------------------------------------------------------
- scan_eol() - Scan for EOL characters.
+ open_at() - Open a file in a directory as a stream.
 
-    IN         FMT
-    -------    ------------
-    CR + LF    MS-DOS
-    CR         Macintosh
-    LF         UNIX
+    mode is "rb", "r+b" or "w+b", as for fopen().  Without openat(), dirfd
+    is ignored and name is opened as it is.
  ------------------------------------------------------------------------------
  */
 
-unsigned long scan_eol(FILE *file_in)
+FILE *open_at(int dirfd, char *name, char *mode)
 {
-    int ch;
-    const int ch_CR = '\r';
-    const int ch_LF = '\n';
-    unsigned long nl;
+#ifdef EOL_OPENAT
+    FILE *f;
+    int fd;
+    int flags = (mode[0] == 'w') ? O_RDWR | O_CREAT | O_TRUNC
+                                 : (mode[1] == '+') ? O_RDWR : O_RDONLY;
 
-    nl = 0L;
+    fd = openat(dirfd, name, flags | O_CLOEXEC, 0666);
+    if(fd < 0)
+    {
+        return NULL;
+    }
 
-    /* Read the file one character at a time. */
-    while((ch = getc(file_in)) != EOF)
+    f = fdopen(fd, mode);
+    if(f == NULL)
     {
-        /* Process the character. */
-        if(ch == ch_CR)
-        {
-            /* CR.  Could be CR alone, or CR followed by LF. */
+        close(fd);
+    }
 
-            /* Count the line. */
-            nl++;
+    return f;
+#else
+    return fopen(name, mode);
+#endif /* EOL_OPENAT */
+}
+
+/*
+ ------------------------------------------------------------------------------
+ rename_at() - Rename a file within a directory.
+ ------------------------------------------------------------------------------
+ */
+
+int rename_at(int dirfd, char *from, char *to)
+{
+#ifdef EOL_OPENAT
+    return renameat(dirfd, from, dirfd, to);
+#else
+    return rename(from, to);
+#endif /* EOL_OPENAT */
+}
+
+/*
+ ------------------------------------------------------------------------------
+ File lists for --files-from.
+
+    The names are read one at a time and each is processed as soon as it
+    has arrived, so a list can be piped in while it is being made.  With
+    -j N, the names go through a ring of EOL_STREAM_WINDOW slots to N
+    threads; the reading waits while the ring is full, so memory stays the
+    same however long the list is.  The reports of the names are written
+    in list order as in eol_files(), from the same ring.  Files cannot be
+    sorted by size here, since the list is not known in advance.
+ ------------------------------------------------------------------------------
+ */
+
+#define EOL_STREAM_WINDOW 256
 
-            /* See if the character was CR alone, or CR followed by LF. */
+/*
+ ------------------------------------------------------------------------------
+ read_name() - Read the next name of a list, up to delim or EOF.
+
+    *buf is grown as needed.  For a list of lines, a CR before the LF is
+    dropped.  Empty names are skipped.  Returns 0, or -1 at the end of the
+    list or if there is no memory.
+ ------------------------------------------------------------------------------
+ */
 
-            /* Read the next character after the CR. */
-            ch = getc(file_in);
+int read_name(FILE *list, int delim, char **buf, size_t *size)
+{
+    size_t len;
+    char *grown;
+    int ch;
 
-            /* See what it is. */
-            if(ch == ch_LF)
+    do
+    {
+        len = 0;
+        while((ch = getc(list)) != EOF && ch != delim)
+        {
+            if(len + 1 >= *size)
             {
-                /* LF after CR: Count it as MS-DOS. */
-                cnt_msdos++;
+                if((grown = realloc(*buf, 2 * *size + 256)) == NULL)
+                {
+                    return -1;
+                }
+                *buf = grown;
+                *size = 2 * *size + 256;
             }
-            else
+            (*buf)[len++] = (char)ch;
+        }
+
+        if(delim == '\n' && len > 0 && (*buf)[len - 1] == '\r')
+        {
+            len--;
+        }
+    } while(len == 0 && ch != EOF);
+
+    if(len == 0)
+    {
+        return -1;
+    }
+
+    (*buf)[len] = '\0';
+
+    return 0;
+}
+
+/* Process one name from a list. */
+int eol_listed(char *name)
+{
+    return recursive ? walk_files(&name, 1, 1) : eol_file(name);
+}
+
+#ifdef EOL_THREADS
+
+/* Names of a list on their way to the threads, and their reports. */
+struct eol_stream
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    char *name[EOL_STREAM_WINDOW];
+    struct eol_report report[EOL_STREAM_WINDOW];
+    int done[EOL_STREAM_WINDOW];
+    unsigned long next_in;      /* names read */
+    unsigned long next_take;    /* names taken by threads */
+    unsigned long next_out;     /* reports written */
+    int eof;
+    int err;
+    double total;               /* line ends counted by the threads */
+};
+
+void *stream_thread(void *arg)
+{
+    struct eol_stream *st = arg;
+    struct eol_report r;
+    double before = cnt_grand_total;
+    unsigned long n;
+    size_t slot;
+    int err;
+
+    pthread_mutex_lock(&st->lock);
+
+    for(;;)
+    {
+        while(st->next_take == st->next_in && !st->eof)
+        {
+            pthread_cond_wait(&st->changed, &st->lock);
+        }
+        if(st->next_take == st->next_in)
+        {
+            break;
+        }
+
+        n = st->next_take++;
+        slot = n % EOL_STREAM_WINDOW;
+        pthread_mutex_unlock(&st->lock);
+
+        r.text = 0;
+        r.len = 0;
+        r.size = 0;
+        report_to = &r;
+        err = eol_listed(st->name[slot]);
+        report_to = 0;
+
+        pthread_mutex_lock(&st->lock);
+        st->report[slot] = r;
+        st->done[slot] = 1;
+        st->err |= err;
+
+        /* Write the reports that are next in list order. */
+        while(st->next_out < st->next_take &&
+              st->done[slot = st->next_out % EOL_STREAM_WINDOW])
+        {
+            if(st->report[slot].len > 0)
             {
-                /* No LF after CR: Count it as Macintosh. */
-                cnt_mac++;
+                fwrite(st->report[slot].text, 1, st->report[slot].len, stderr);
             }
+            free(st->report[slot].text);
+            free(st->name[slot]);
+            st->done[slot] = 0;
+            st->next_out++;
+        }
+        pthread_cond_broadcast(&st->changed);
+    }
+
+    st->total += cnt_grand_total - before;
+    pthread_mutex_unlock(&st->lock);
+
+    return 0;
+}
+
+#endif /* EOL_THREADS */
 
-            if(ch == EOF)
+/*
+ ------------------------------------------------------------------------------
+ stream_files() - Set or scan the EOL characters of the files in a list.
+
+    list_name is the file with the list, or - for stdin.  The names end
+    with delim.  The line ends are added to cnt_grand_total.  Returns 0, or
+    1 if the list cannot be read or any file had an error.
+ ------------------------------------------------------------------------------
+ */
+
+int stream_files(char *list_name, int delim, int jobs)
+{
+    FILE *list;
+    char *name = 0;
+    size_t size = 0;
+    int err = 0;
+#ifdef EOL_THREADS
+    struct eol_stream *st = 0;
+    pthread_t thread[64];
+    size_t slot;
+    int i, started = 0;
+#endif /* EOL_THREADS */
+
+    list = (strcmp(list_name, "-") == 0) ? stdin : fopen(list_name, "rb");
+    if(list == NULL)
+    {
+        fprintf(stderr,
+                "Error: Cannot open file list %s.\n"
+                "       Reason: %s.\n",
+                list_name, strerror(errno));
+        return 1;
+    }
+
+#ifdef EOL_THREADS
+    if(jobs > (int)(sizeof(thread) / sizeof(thread[0])))
+    {
+        jobs = (int)(sizeof(thread) / sizeof(thread[0]));
+    }
+    if(jobs > 1 && (st = calloc(1, sizeof(*st))) != 0)
+    {
+        pthread_mutex_init(&st->lock, 0);
+        pthread_cond_init(&st->changed, 0);
+
+        for(started = 0; started < jobs; started++)
+        {
+            if(pthread_create(&thread[started], 0, stream_thread, st) != 0)
             {
-                /* EOF: Break from the read loop. Finished this file. */
                 break;
             }
         }
-        else if(ch == ch_LF)
+    }
+
+    if(started > 0)
+    {
+        /* Hand each name to the threads, waiting while the ring is full. */
+        while(read_name(list, delim, &name, &size) == 0)
         {
-            /* LF. */
+            pthread_mutex_lock(&st->lock);
+            while(st->next_in - st->next_out >= EOL_STREAM_WINDOW)
+            {
+                pthread_cond_wait(&st->changed, &st->lock);
+            }
+            slot = st->next_in % EOL_STREAM_WINDOW;
+            st->name[slot] = name;
+            st->next_in++;
+            pthread_cond_broadcast(&st->changed);
+            pthread_mutex_unlock(&st->lock);
+
+            name = 0;
+            size = 0;
+        }
 
-            /* Count the line. */
-            nl++;
+        pthread_mutex_lock(&st->lock);
+        st->eof = 1;
+        pthread_cond_broadcast(&st->changed);
+        pthread_mutex_unlock(&st->lock);
 
-            /* Count it as UNIX. */
-            cnt_unix++;
+        for(i = 0; i < started; i++)
+        {
+            pthread_join(thread[i], 0);
         }
-        else
+
+        cnt_grand_total += st->total;
+        err = st->err;
+    }
+    else
+#endif /* EOL_THREADS */
+    {
+        while(read_name(list, delim, &name, &size) == 0)
         {
-            /* Regular character. */
+            if(eol_listed(name) != 0)
+            {
+                err = 1;
+            }
         }
     }
-    /* End of while loop reading input file. */
 
-    /* Return the number of end-of-lines processed. */
-    return nl;
+    if(ferror(list))
+    {
+        fprintf(stderr,
+                "Error: Cannot read file list %s.\n"
+                "       Reason: %s.\n",
+                list_name, strerror(errno));
+        err = 1;
+    }
+
+#ifdef EOL_THREADS
+    if(st != 0)
+    {
+        pthread_cond_destroy(&st->changed);
+        pthread_mutex_destroy(&st->lock);
+        free(st);
+    }
+#endif /* EOL_THREADS */
+
+    free(name);
+    if(list != stdin)
+    {
+        fclose(list);
+    }
+
+    return err;
+}
+
+#ifdef EOL_WALK
+
+/*
+ ------------------------------------------------------------------------------
+ Directory walk for -r.
+
+    Directories waiting to be read are kept on a stack shared by the
+    threads, so the walk goes deep first and few directories are open at a
+    time.  A thread takes a directory, opens it relative to its parent with
+    openat(), reads all its names (with getdents64() on Linux), puts its
+    subdirectories on the stack for any thread to take, and then processes
+    its files with eol_file_at(), relative to the directory.  A directory
+    stays open until its files are done and all its subdirectories have
+    been opened.
+
+    Symbolic links to directories are not followed, and names ending in
+    EOL_TEMP_EXTENSION are skipped.  A symbolic link to a file is followed
+    from the directory it is in, with readlinkat() and openat(), and the
+    file is set where it is, unless it is outside the command line
+    directory.  With more than one thread, the messages of each file are
+    written together, in the order the files are done.
+ ------------------------------------------------------------------------------
+ */
+
+/* A directory to read. */
+struct eol_dir
+{
+    struct eol_dir *parent;     /* open directory it is in, until opened */
+    struct eol_dir *next;       /* next on the stack */
+    char *path;                 /* name in messages, ending with its name */
+    size_t name_at;             /* where its name starts in path */
+    int fd;
+    int depth;                  /* 0 for a directory on the command line */
+    dev_t dev;                  /* filesystem of the command line directory */
+    ino_t ino;                  /* and its inode */
+    int refs;                   /* itself, and subdirectories not yet opened */
+};
+
+struct eol_walk
+{
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    struct eol_dir *stack;
+    int busy;                   /* threads working on a directory */
+    int collect;                /* collect the messages of each file */
+    int err;
+    double total;               /* line ends counted by all threads */
+};
+
+/* The names in a directory, in one buffer. */
+struct eol_names
+{
+    char *text;
+    size_t len;
+    size_t size;
+    size_t n;
+};
+
+/*
+ ------------------------------------------------------------------------------
+ add_name() - Add a name and its d_type to a list of names.
+
+    Each name is stored as its type byte followed by the name and a NUL.
+    Returns 0, or -1 if there is no memory.
+ ------------------------------------------------------------------------------
+ */
+
+int add_name(struct eol_names *names, const char *name, unsigned char type)
+{
+    size_t len = strlen(name) + 2;
+    size_t size;
+    char *text;
+
+    if(name[0] == '.' &&
+       (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+    {
+        return 0;
+    }
+
+    if(names->len + len > names->size)
+    {
+        size = 2 * names->size + len + 4096;
+        if((text = realloc(names->text, size)) == NULL)
+        {
+            return -1;
+        }
+        names->text = text;
+        names->size = size;
+    }
+
+    names->text[names->len] = (char)type;
+    memcpy(names->text + names->len + 1, name, len - 1);
+    names->len += len;
+    names->n++;
+
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ read_names() - Read all the names in an open directory.
+
+    Returns 0, or an errno value.
+ ------------------------------------------------------------------------------
+ */
+
+int read_names(int fd, struct eol_names *names)
+{
+#ifdef __linux__
+    /* The layout getdents64() fills in. */
+    struct eol_dirent64
+    {
+        uint64_t d_ino;
+        int64_t d_off;
+        unsigned short d_reclen;
+        unsigned char d_type;
+        char d_name[1];
+    } *e;
+    char buf[32 * 1024];
+    long n, at;
+
+    while((n = syscall(SYS_getdents64, fd, buf, sizeof(buf))) > 0)
+    {
+        for(at = 0; at < n; at += e->d_reclen)
+        {
+            e = (struct eol_dirent64 *)(buf + at);
+            if(add_name(names, e->d_name, e->d_type) != 0)
+            {
+                return ENOMEM;
+            }
+        }
+    }
+
+    return (n < 0) ? errno : 0;
+#else
+    DIR *dir;
+    struct dirent *e;
+    int dup_fd = dup(fd);
+
+    if(dup_fd < 0 || (dir = fdopendir(dup_fd)) == NULL)
+    {
+        if(dup_fd >= 0)
+        {
+            close(dup_fd);
+        }
+        return errno;
+    }
+
+    errno = 0;
+    while((e = readdir(dir)) != NULL)
+    {
+        if(add_name(names, e->d_name, DT_UNKNOWN) != 0)
+        {
+            closedir(dir);
+            return ENOMEM;
+        }
+    }
+    n = errno;
+    closedir(dir);
+
+    return (int)n;
+#endif /* __linux__ */
+}
+
+/* Drop a reference to a directory, and close it with the last one. */
+void release_dir(struct eol_walk *w, struct eol_dir *d)
+{
+    int refs;
+
+    pthread_mutex_lock(&w->lock);
+    refs = --d->refs;
+    pthread_mutex_unlock(&w->lock);
+
+    if(refs == 0)
+    {
+        if(d->fd >= 0)
+        {
+            close(d->fd);
+        }
+        free(d->path);
+        free(d);
+    }
+}
+
+/* Put a directory on the stack. */
+void push_dir(struct eol_walk *w, struct eol_dir *d)
+{
+    pthread_mutex_lock(&w->lock);
+    d->next = w->stack;
+    w->stack = d;
+    pthread_cond_signal(&w->work);
+    pthread_mutex_unlock(&w->lock);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ new_dir() - Make a directory to read, named name in parent.
+
+    parent is 0 for a directory on the command line, which is opened now.
+    Returns the directory, or 0 on error, which has been reported.
+ ------------------------------------------------------------------------------
+ */
+
+struct eol_dir *new_dir(struct eol_walk *w, struct eol_dir *parent, char *name)
+{
+    struct eol_dir *d = calloc(1, sizeof(*d));
+    size_t len = parent ? strlen(parent->path) : 0;
+    struct stat sb;
+
+    if(d == 0 || (d->path = malloc(len + strlen(name) + 2)) == 0)
+    {
+        free(d);
+        report("Error: Cannot read directory %s.\n"
+               "       Reason: %s.\n",
+               name, strerror(ENOMEM));
+        return 0;
+    }
+
+    if(parent == 0)
+    {
+        strcpy(d->path, name);
+        d->fd = open(name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(d->fd < 0 || fstat(d->fd, &sb) != 0)
+        {
+            report("Error: Cannot open directory %s.\n"
+                   "       Reason: %s.\n",
+                   name, strerror(errno));
+            if(d->fd >= 0)
+            {
+                close(d->fd);
+            }
+            free(d->path);
+            free(d);
+            return 0;
+        }
+        d->dev = sb.st_dev;
+        d->ino = sb.st_ino;
+    }
+    else
+    {
+        /* Opened by the thread that takes it. */
+        memcpy(d->path, parent->path, len);
+        if(len > 0 && d->path[len - 1] != '/')
+        {
+            d->path[len++] = '/';
+        }
+        d->name_at = len;
+        strcpy(d->path + len, name);
+        d->fd = -1;
+        d->depth = parent->depth + 1;
+        d->dev = parent->dev;
+        d->ino = parent->ino;
+        d->parent = parent;
+
+        pthread_mutex_lock(&w->lock);
+        parent->refs++;
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    d->refs = 1;
+
+    return d;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ resolve_link() - Find the file a symbolic link in a directory points to.
+
+    Follows the link name in the open directory dirfd, and any links it
+    leads to, each from the directory it is in.  Returns 0, with *fd open
+    on the directory of the file and its name in base, which has room for
+    EOL_NAME_MAX bytes, or an errno value if it is not a regular file.
+ ------------------------------------------------------------------------------
+ */
+
+int resolve_link(int dirfd, char *name, int *fd, char *base)
+{
+    char target[4096];
+    char *file;
+    struct stat sb;
+    ssize_t n;
+    int hops, next, error;
+
+    if((*fd = openat(dirfd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+    {
+        return errno;
+    }
+    strcpy(base, name);
+
+    for(hops = 0; hops < 40; hops++)
+    {
+        if(fstatat(*fd, base, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+        {
+            break;
+        }
+        if(S_ISREG(sb.st_mode))
+        {
+            return 0;
+        }
+        if(!S_ISLNK(sb.st_mode))
+        {
+            errno = S_ISDIR(sb.st_mode) ? EISDIR : EINVAL;
+            break;
+        }
+
+        n = readlinkat(*fd, base, target, sizeof(target) - 1);
+        if(n <= 0)
+        {
+            break;
+        }
+        target[n] = '\0';
+
+        /* Open the directory of the target, relative to this one. */
+        if((file = strrchr(target, '/')) == 0)
+        {
+            file = target;
+        }
+        else
+        {
+            *file++ = '\0';
+            next = openat(*fd, file == target + 1 ? "/" : target,
+                          O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if(next < 0)
+            {
+                break;
+            }
+            close(*fd);
+            *fd = next;
+        }
+
+        if(strlen(file) >= EOL_NAME_MAX)
+        {
+            errno = ENAMETOOLONG;
+            break;
+        }
+        strcpy(base, *file ? file : ".");
+    }
+
+    if(hops == 40)
+    {
+        errno = ELOOP;
+    }
+    error = errno;
+    close(*fd);
+    *fd = -1;
+
+    return error;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ in_tree() - Whether the open directory fd is in the command line directory
+             of d, found by going up through its parent directories.
+ ------------------------------------------------------------------------------
+ */
+
+int in_tree(int fd, struct eol_dir *d)
+{
+    struct stat sb;
+    dev_t dev;
+    ino_t ino;
+    int up;
+
+    if((fd = dup(fd)) < 0 || fstat(fd, &sb) != 0)
+    {
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+        return 0;
+    }
+
+    while(sb.st_dev != d->dev || sb.st_ino != d->ino)
+    {
+        dev = sb.st_dev;
+        ino = sb.st_ino;
+        up = openat(fd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(fd);
+        fd = up;
+
+        /* The parent of / is / itself. */
+        if(fd < 0 || fstat(fd, &sb) != 0 ||
+           (sb.st_dev == dev && sb.st_ino == ino))
+        {
+            if(fd >= 0)
+            {
+                close(fd);
+            }
+            return 0;
+        }
+    }
+
+    close(fd);
+
+    return 1;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ walk_dir() - Read a directory, queue its subdirectories and process its
+              files.
+ ------------------------------------------------------------------------------
+ */
+
+void walk_dir(struct eol_walk *w, struct eol_dir *d)
+{
+    struct eol_names names;
+    struct eol_report r;
+    struct eol_report *outer = report_to;
+    struct eol_dir *sub;
+    struct stat sb;
+    char *name, *path;
+    char base[EOL_NAME_MAX];
+    size_t at, len;
+    unsigned char type;
+    int error, err = 0;
+    int link, fd;
+
+    /* Open it relative to its parent, and let the parent go. */
+    if(d->parent != 0)
+    {
+        d->fd = openat(d->parent->fd, d->path + d->name_at,
+                       O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        error = errno;
+        release_dir(w, d->parent);
+        d->parent = 0;
+
+        if(d->fd < 0)
+        {
+            report("Error: Cannot open directory %s.\n"
+                   "       Reason: %s.\n",
+                   d->path, strerror(error));
+            err = 1;
+            goto done;
+        }
+
+        if(one_file_system && (fstat(d->fd, &sb) != 0 || sb.st_dev != d->dev))
+        {
+            goto done;
+        }
+    }
+
+    memset(&names, 0, sizeof(names));
+    if((error = read_names(d->fd, &names)) != 0)
+    {
+        report("Error: Cannot read directory %s.\n"
+               "       Reason: %s.\n",
+               d->path, strerror(error));
+        err = 1;
+    }
+
+    len = strlen(d->path);
+    path = malloc(len + 2 + EOL_NAME_MAX);
+
+    for(at = 0; path != 0 && at < names.len; at += strlen(name) + 2)
+    {
+        type = (unsigned char)names.text[at];
+        name = names.text + at + 1;
+
+        if(type == DT_UNKNOWN)
+        {
+            if(fstatat(d->fd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                continue;
+            }
+            type = S_ISDIR(sb.st_mode) ? DT_DIR :
+                   S_ISREG(sb.st_mode) ? DT_REG :
+                   S_ISLNK(sb.st_mode) ? DT_LNK : DT_UNKNOWN;
+        }
+
+        if(type == DT_DIR)
+        {
+            /* Its files would be at depth + 2. */
+            if((max_depth < 0 || d->depth + 2 <= max_depth) &&
+               (sub = new_dir(w, d, name)) != 0)
+            {
+                push_dir(w, sub);
+            }
+        }
+    }
+
+    /* Process the files of the directory, unless they are too deep. */
+    if(max_depth >= 0 && d->depth + 1 > max_depth)
+    {
+        names.len = 0;
+    }
+
+    for(at = 0; path != 0 && at < names.len; at += strlen(name) + 2)
+    {
+        type = (unsigned char)names.text[at];
+        name = names.text + at + 1;
+        link = 0;
+
+        if(strlen(name) >= EOL_NAME_MAX ||
+           (strlen(name) >= strlen(EOL_TEMP_EXTENSION) &&
+            strcmp(name + strlen(name) - strlen(EOL_TEMP_EXTENSION),
+                   EOL_TEMP_EXTENSION) == 0))
+        {
+            continue;
+        }
+
+        memcpy(path, d->path, len);
+        path[len] = '/';
+        strcpy(path + len + (d->path[len - 1] != '/'), name);
+
+        if(type == DT_UNKNOWN || type == DT_LNK)
+        {
+            if(fstatat(d->fd, name, &sb, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                continue;
+            }
+            if(S_ISLNK(sb.st_mode))
+            {
+                if(!walk_symlinks)
+                {
+                    continue;
+                }
+                if(fstatat(d->fd, name, &sb, 0) != 0)
+                {
+                    if (verbose)
+                    {
+                        report("\n%s: Skipping symbolic link to nothing (%s).\n",
+                               path, strerror(errno));
+                    }
+                    continue;
+                }
+                link = 1;
+            }
+            type = S_ISREG(sb.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+
+        if(type != DT_REG)
+        {
+            continue;
+        }
+
+        r.text = 0;
+        r.len = 0;
+        r.size = 0;
+        report_to = w->collect ? &r : outer;
+
+        if(link && operation == EOL_SET_OPERATION)
+        {
+            /*
+             Set the file the link points to, in its own directory, so the
+             temporary file is renamed over it and the link is left alone.
+             */
+            if((error = resolve_link(d->fd, name, &fd, base)) != 0)
+            {
+                report("Error: Cannot open input file %s.\n"
+                       "       Reason: %s.\n",
+                       path, strerror(error));
+                err = 1;
+            }
+            else
+            {
+                if(!follow_outside && !in_tree(fd, d))
+                {
+                    report("\n%s: Skipping link outside the directory "
+                           "(see --follow-outside).\n", path);
+                }
+                else if(eol_file_at(fd, base, path) != 0)
+                {
+                    err = 1;
+                }
+                close(fd);
+            }
+        }
+        else if(eol_file_at(d->fd, name, path) != 0)
+        {
+            err = 1;
+        }
+
+        report_to = outer;
+        if(r.len > 0)
+        {
+            fwrite(r.text, 1, r.len, stderr);
+        }
+        free(r.text);
+    }
+
+    if(path == 0)
+    {
+        report("Error: Cannot read directory %s.\n"
+               "       Reason: %s.\n",
+               d->path, strerror(ENOMEM));
+        err = 1;
+    }
+
+    free(path);
+    free(names.text);
+
+done:
+    if(err)
+    {
+        pthread_mutex_lock(&w->lock);
+        w->err = 1;
+        pthread_mutex_unlock(&w->lock);
+    }
+
+    release_dir(w, d);
+}
+
+/* Take directories from the stack until all are done. */
+void *walk_thread(void *arg)
+{
+    struct eol_walk *w = arg;
+    struct eol_dir *d;
+    double before = cnt_grand_total;
+
+    pthread_mutex_lock(&w->lock);
+
+    for(;;)
+    {
+        while(w->stack == 0 && w->busy > 0)
+        {
+            pthread_cond_wait(&w->work, &w->lock);
+        }
+        if(w->stack == 0)
+        {
+            break;
+        }
+
+        d = w->stack;
+        w->stack = d->next;
+        w->busy++;
+        pthread_mutex_unlock(&w->lock);
+
+        walk_dir(w, d);
+
+        pthread_mutex_lock(&w->lock);
+        w->busy--;
+        if(w->busy == 0 && w->stack == 0)
+        {
+            pthread_cond_broadcast(&w->work);
+        }
+    }
+
+    w->total += cnt_grand_total - before;
+    pthread_mutex_unlock(&w->lock);
+
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ walk_files() - Set or scan the EOL characters of files and directory trees.
+
+    Files on the command line are processed first, as without -r.  Then the
+    directories are walked on jobs threads.  The line ends are added to
+    cnt_grand_total.  Returns 0, or 1 if any file had an error.
+ ------------------------------------------------------------------------------
+ */
+
+int walk_files(char **files, int n_files, int jobs)
+{
+    struct eol_walk w;
+    struct eol_dir *d;
+    struct stat sb;
+    pthread_t *thread;
+    double before;
+    int i, started = 0;
+    int err = 0;
+
+    pthread_mutex_init(&w.lock, 0);
+    pthread_cond_init(&w.work, 0);
+    w.stack = 0;
+    w.busy = 0;
+    w.collect = (jobs > 1);
+    w.err = 0;
+    w.total = 0;
+
+    for(i = n_files - 1; i >= 0; i--)
+    {
+        if(strcmp(files[i], "-") != 0 && stat(files[i], &sb) == 0 &&
+           S_ISDIR(sb.st_mode))
+        {
+            if((d = new_dir(&w, 0, files[i])) != 0)
+            {
+                push_dir(&w, d);
+            }
+            else
+            {
+                err = 1;
+            }
+        }
+    }
+
+    for(i = 0; i < n_files; i++)
+    {
+        if(strcmp(files[i], "-") == 0 || stat(files[i], &sb) != 0 ||
+           !S_ISDIR(sb.st_mode))
+        {
+            if(eol_file(files[i]) != 0)
+            {
+                err = 1;
+            }
+        }
+    }
+
+    before = cnt_grand_total;
+
+    thread = (jobs > 1) ? malloc((size_t)(jobs - 1) * sizeof(*thread)) : 0;
+    for(started = 0; thread != 0 && started < jobs - 1; started++)
+    {
+        if(pthread_create(&thread[started], 0, walk_thread, &w) != 0)
+        {
+            break;
+        }
+    }
+
+    walk_thread(&w);
+
+    for(i = 0; i < started; i++)
+    {
+        pthread_join(thread[i], 0);
+    }
+    free(thread);
+
+    /* w.total has the line ends of this thread too. */
+    cnt_grand_total = before + w.total;
+
+    pthread_cond_destroy(&w.work);
+    pthread_mutex_destroy(&w.lock);
+
+    return err | w.err;
+}
+
+#else
+
+int walk_files(char **files, int n_files, int jobs)
+{
+    fprintf(stderr, "Error: -r is not supported on this system.\n");
+    return 1;
+}
+
+#endif /* EOL_WALK */
+
+#ifdef EOL_URING
+
+/*
+ ------------------------------------------------------------------------------
+ io_uring engine for many small files.
+
+    Files smaller than EOL_URING_FILE_SIZE are read whole, converted in
+    memory and written whole, with the open, read, write, close and rename
+    of up to EOL_URING_DEPTH files in flight at once.  A file is read until
+    a read returns nothing, so a short read is never taken for the end of
+    the file.  Each turn of the loop
+    submits every operation queued since the last turn in one system call
+    and converts the files whose reads have completed while the kernel
+    works on the others.  The write and the close of a temporary file are
+    linked, so they are submitted together.
+
+    A file that turns out to be larger, or that cannot be opened or read,
+    is processed by eol_file() instead, which also reports its errors.  The
+    reports of the files are written in command line order.
+ ------------------------------------------------------------------------------
+ */
+
+#define EOL_URING_FILE_SIZE (32 * 1024)
+#define EOL_URING_DEPTH 64
+#define EOL_URING_ENTRIES 256
+
+/* Operations of a file, kept in the user data of its requests. */
+enum EOL_URING_OPS {EOL_URING_OPEN_IN, EOL_URING_READ, EOL_URING_CLOSE_IN,
+                    EOL_URING_OPEN_OUT, EOL_URING_WRITE, EOL_URING_CLOSE_OUT,
+                    EOL_URING_RENAME};
+#define EOL_URING_OP_BITS 3
+
+/* A ring, mapped from the kernel. */
+struct eol_uring
+{
+    int fd;
+    void *sq_ring;
+    size_t sq_ring_len;
+    void *cq_ring;
+    size_t cq_ring_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;         /* queued, not yet submitted */
+    int have_rename;            /* the kernel can rename through the ring */
+};
+
+/* A file in flight. */
+struct eol_uring_file
+{
+    char *name;
+    char temp[512];
+    int fd_in;
+    int fd_out;
+    int pending;                /* requests in flight */
+    int finished;               /* no more requests will be made */
+    int fallback;               /* process with eol_file() when pending is 0 */
+    int write_res;
+    unsigned char *in;
+    unsigned char *out;
+    size_t len;
+    size_t out_len;
+    struct eol_report report;
+    int err;
+};
+
+void uring_exit(struct eol_uring *u)
+{
+    if(u->sqes != 0)
+    {
+        munmap(u->sqes, u->sqes_len);
+    }
+    if(u->cq_ring != 0)
+    {
+        munmap(u->cq_ring, u->cq_ring_len);
+    }
+    if(u->sq_ring != 0)
+    {
+        munmap(u->sq_ring, u->sq_ring_len);
+    }
+    close(u->fd);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ uring_init() - Set up a ring of entries requests.
+
+    Returns 0, or -1 if the kernel has no io_uring, does not allow it, or
+    cannot open, read, write and close files through it.
+ ------------------------------------------------------------------------------
+ */
+
+int uring_init(struct eol_uring *u, unsigned entries)
+{
+    static const int needed[] = {IORING_OP_OPENAT, IORING_OP_READ,
+                                 IORING_OP_WRITE, IORING_OP_CLOSE};
+    struct io_uring_params p;
+    struct io_uring_probe *probe;
+    size_t i;
+    int ok;
+
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+
+    u->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if(u->fd < 0)
+    {
+        return -1;
+    }
+
+    u->sq_ring_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    u->sq_ring = mmap(0, u->sq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    u->cq_ring = mmap(0, u->cq_ring_len, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    u->sqes = mmap(0, u->sqes_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if(u->sq_ring == MAP_FAILED || u->cq_ring == MAP_FAILED ||
+       u->sqes == MAP_FAILED)
+    {
+        u->sq_ring = (u->sq_ring == MAP_FAILED) ? 0 : u->sq_ring;
+        u->cq_ring = (u->cq_ring == MAP_FAILED) ? 0 : u->cq_ring;
+        u->sqes = (u->sqes == MAP_FAILED) ? 0 : u->sqes;
+        uring_exit(u);
+        return -1;
+    }
+
+    u->sq_head = (unsigned *)((char *)u->sq_ring + p.sq_off.head);
+    u->sq_tail = (unsigned *)((char *)u->sq_ring + p.sq_off.tail);
+    u->sq_array = (unsigned *)((char *)u->sq_ring + p.sq_off.array);
+    u->sq_mask = *(unsigned *)((char *)u->sq_ring + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->cq_head = (unsigned *)((char *)u->cq_ring + p.cq_off.head);
+    u->cq_tail = (unsigned *)((char *)u->cq_ring + p.cq_off.tail);
+    u->cq_mask = *(unsigned *)((char *)u->cq_ring + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)((char *)u->cq_ring + p.cq_off.cqes);
+
+    /* Check that the kernel has the operations, which came in 5.6. */
+    probe = calloc(1, sizeof(*probe) +
+                      IORING_OP_LAST * sizeof(struct io_uring_probe_op));
+    ok = (probe != 0 &&
+          syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PROBE,
+                  probe, IORING_OP_LAST) == 0);
+
+    for(i = 0; ok && i < sizeof(needed) / sizeof(needed[0]); i++)
+    {
+        ok = (needed[i] <= probe->last_op &&
+              (probe->ops[needed[i]].flags & IO_URING_OP_SUPPORTED));
+    }
+    u->have_rename = (ok && IORING_OP_RENAMEAT <= probe->last_op &&
+                      (probe->ops[IORING_OP_RENAMEAT].flags &
+                       IO_URING_OP_SUPPORTED));
+    free(probe);
+
+    if(!ok)
+    {
+        uring_exit(u);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ uring_enter() - Submit the queued requests, and wait for wait completions.
+
+    Returns 0, or -1 on error.
+ ------------------------------------------------------------------------------
+ */
+
+int uring_enter(struct eol_uring *u, unsigned wait)
+{
+    int n;
+
+    do
+    {
+        n = (int)syscall(__NR_io_uring_enter, u->fd, u->to_submit, wait,
+                         wait ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+        if(n > 0)
+        {
+            u->to_submit -= (unsigned)n;
+        }
+    } while((n < 0 && errno == EINTR) || (n > 0 && u->to_submit > 0));
+
+    return (n < 0) ? -1 : 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ uring_sqe() - Queue a request for operation op of file slot.
+
+    Returns the request, cleared except for its opcode, fd and user data.
+ ------------------------------------------------------------------------------
+ */
+
+struct io_uring_sqe *uring_sqe(struct eol_uring *u, struct eol_uring_file *f,
+                               size_t slot, int opcode, int op, int fd)
+{
+    struct io_uring_sqe *sqe;
+    unsigned tail = *u->sq_tail;
+
+    /* A full queue is submitted first. */
+    if(tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >= u->sq_entries)
+    {
+        uring_enter(u, 0);
+    }
+
+    sqe = &u->sqes[tail & u->sq_mask];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)opcode;
+    sqe->fd = fd;
+    sqe->user_data = ((unsigned long long)slot << EOL_URING_OP_BITS) |
+                     (unsigned long long)op;
+
+    u->sq_array[tail & u->sq_mask] = tail & u->sq_mask;
+    __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    u->to_submit++;
+    f->pending++;
+
+    return sqe;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ uring_convert() - Scan or set the line ends of a file that has been read.
+
+    Reports like eol_file().  Returns 1 if the converted file must be
+    written, or 0 if the file is done.
+ ------------------------------------------------------------------------------
+ */
+
+int uring_convert(struct eol_uring_file *f)
+{
+    struct eol_counts cnt;
+    struct eol_ctx *ctx;
+
+    if((ctx = eol_new(EOL_SCAN)) == 0)
+    {
+        report("Error: Out of memory.\n");
+        f->err = 1;
+        return 0;
+    }
+
+    /* A CR at EOF has no LF after it: eol_finish() counts it as Macintosh. */
+    eol_feed(ctx, f->in, f->len, 0);
+    eol_finish(ctx);
+    eol_get_counts(ctx, &cnt);
+    eol_free(ctx);
+
+    if(operation == EOL_SCAN_OPERATION)
+    {
+        if (verbose)
+        {
+            report("\n%s: Scanning for end-of-line characters.\n", f->name);
+        }
+
+        cnt_msdos = cnt.cnt_msdos;
+        cnt_mac = cnt.cnt_mac;
+        cnt_unix = cnt.cnt_unix;
+        cnt_eol = cnt_msdos + cnt_mac + cnt_unix;
+        cnt_grand_total += cnt_eol;
+
+        report_scan(f->name);
+        return 0;
+    }
+
+    /* Leave a file that already has these line ends alone. */
+    if(eol_conforming(output_format, &cnt))
+    {
+        if (verbose)
+        {
+            report("\n%s: Already conforming to %s end-of-line characters.\n"
+                   "%s: Left unchanged, %lu line ends.\n",
+                   f->name, output_format_description[output_format],
+                   f->name, cnt.cnt_msdos + cnt.cnt_mac + cnt.cnt_unix);
+        }
+        return 0;
+    }
+
+    if (verbose)
+    {
+        report("\n%s: Setting %s end-of-line characters.\n",
+               f->name, output_format_description[output_format]);
+    }
+
+    if((ctx = eol_new(output_format)) == 0)
+    {
+        report("Error: Out of memory.\n");
+        f->err = 1;
+        return 0;
+    }
+
+    f->out_len = eol_feed(ctx, f->in, f->len, f->out);
+
+    if (verbose)
+    {
+        report("%s: Processed %lu line ends with %s kernels.\n",
+               f->name, eol_line_ends(ctx), eol_kernel_name(ctx));
+    }
+
+    eol_free(ctx);
+
+    return 1;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ uring_renamed() - Finish a file once its temporary file has been renamed.
+
+    res is 0, or the negated errno of the rename.
+ ------------------------------------------------------------------------------
+ */
+
+void uring_renamed(struct eol_uring_file *f, int res)
+{
+    if(res < 0)
+    {
+        report("rename() return: %d\n", -1);
+        report("Error: Cannot rename temporary output %s\n"
+               "       to the original input name %s.\n"
+               "       Reason: %s\n",
+               f->temp, f->name, strerror(-res));
+    }
+
+    f->finished = 1;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ uring_complete() - Handle the completion of operation op of file slot.
+ ------------------------------------------------------------------------------
+ */
+
+void uring_complete(struct eol_uring *u, struct eol_uring_file *f,
+                    size_t slot, int op, int res)
+{
+    struct io_uring_sqe *sqe;
+
+    f->pending--;
+
+    switch(op)
+    {
+        case EOL_URING_OPEN_IN:
+            if(res < 0)
+            {
+                f->fallback = 1;
+                f->finished = 1;
+                break;
+            }
+            f->fd_in = res;
+            sqe = uring_sqe(u, f, slot, IORING_OP_READ, EOL_URING_READ, f->fd_in);
+            sqe->addr = (unsigned long long)(uintptr_t)f->in;
+            sqe->len = EOL_URING_FILE_SIZE;
+            sqe->off = 0;
+            break;
+
+        case EOL_URING_READ:
+            /* A read of data, short or not, is followed by the next one. */
+            if(res > 0 && f->len + (size_t)res < EOL_URING_FILE_SIZE)
+            {
+                f->len += (size_t)res;
+                sqe = uring_sqe(u, f, slot, IORING_OP_READ, EOL_URING_READ,
+                                f->fd_in);
+                sqe->addr = (unsigned long long)(uintptr_t)(f->in + f->len);
+                sqe->len = (unsigned)(EOL_URING_FILE_SIZE - f->len);
+                sqe->off = f->len;
+                break;
+            }
+
+            uring_sqe(u, f, slot, IORING_OP_CLOSE, EOL_URING_CLOSE_IN, f->fd_in);
+
+            /* Too large to be read whole: eol_file() does it. */
+            if(res != 0)
+            {
+                f->fallback = 1;
+                f->finished = 1;
+                break;
+            }
+
+            /* The read of nothing is the end of the file. */
+            report_to = &f->report;
+            if(uring_convert(f) == 0)
+            {
+                f->finished = 1;
+            }
+            else if(snprintf(f->temp, sizeof(f->temp), "%s" EOL_TEMP_EXTENSION,
+                             f->name) >= (int)sizeof(f->temp))
+            {
+                f->fallback = 1;
+                f->finished = 1;
+            }
+            else
+            {
+                sqe = uring_sqe(u, f, slot, IORING_OP_OPENAT,
+                                EOL_URING_OPEN_OUT, AT_FDCWD);
+                sqe->addr = (unsigned long long)(uintptr_t)f->temp;
+                sqe->open_flags = O_RDWR | O_CREAT | O_TRUNC;
+                sqe->len = 0666;
+            }
+            report_to = 0;
+            break;
+
+        case EOL_URING_OPEN_OUT:
+            if(res < 0)
+            {
+                /* eol_file() tries again and reports the error. */
+                f->fallback = 1;
+                f->finished = 1;
+                break;
+            }
+            f->fd_out = res;
+            f->write_res = -ECANCELED;
+
+            /* The close runs after the write, even if the write fails. */
+            sqe = uring_sqe(u, f, slot, IORING_OP_WRITE, EOL_URING_WRITE,
+                            f->fd_out);
+            sqe->addr = (unsigned long long)(uintptr_t)f->out;
+            sqe->len = (unsigned)f->out_len;
+            sqe->off = 0;
+            sqe->flags = IOSQE_IO_HARDLINK;
+            uring_sqe(u, f, slot, IORING_OP_CLOSE, EOL_URING_CLOSE_OUT,
+                      f->fd_out);
+            break;
+
+        case EOL_URING_WRITE:
+            /*
+             Either the write or the close of the output may complete
+             first; whichever completes last goes on to the rename.
+             */
+            f->write_res = res;
+            /* fall through */
+        case EOL_URING_CLOSE_OUT:
+            if(f->pending > 0)
+            {
+                break;
+            }
+
+            report_to = &f->report;
+            if(f->write_res != (int)f->out_len)
+            {
+                report("Error: Cannot write output.\n"
+                       "       Reason: %s.\n",
+                       strerror(f->write_res < 0 ? -f->write_res : ENOSPC));
+                report("Error: %s was not changed.\n"
+                       "       Temporary output left in %s.\n",
+                       f->name, f->temp);
+                f->err = 1;
+                f->finished = 1;
+            }
+            else if(u->have_rename)
+            {
+                sqe = uring_sqe(u, f, slot, IORING_OP_RENAMEAT,
+                                EOL_URING_RENAME, AT_FDCWD);
+                sqe->addr = (unsigned long long)(uintptr_t)f->temp;
+                sqe->len = (unsigned)AT_FDCWD;
+                sqe->addr2 = (unsigned long long)(uintptr_t)f->name;
+            }
+            else
+            {
+                uring_renamed(f, rename(f->temp, f->name) == 0 ? 0 : -errno);
+            }
+            report_to = 0;
+            break;
+
+        case EOL_URING_RENAME:
+            report_to = &f->report;
+            uring_renamed(f, res);
+            report_to = 0;
+            break;
+
+        default:
+            /* EOL_URING_CLOSE_IN */
+            break;
+    }
+}
+
+/*
+ ------------------------------------------------------------------------------
+ uring_files() - Set or scan the EOL characters of files through io_uring.
+
+    The line ends are added to cnt_grand_total.  Returns 0, 1 if any file
+    had an error, or -1 if io_uring cannot be used, in which case no file
+    has been processed.
+ ------------------------------------------------------------------------------
+ */
+
+int uring_files(char **files, int n_files)
+{
+    struct eol_uring u;
+    struct eol_uring_file *file, *f;
+    struct io_uring_cqe *cqe;
+    unsigned char *buffers;
+    size_t stride = 3 * EOL_URING_FILE_SIZE + EOL_SLACK;
+    size_t slot;
+    unsigned head;
+    int next_in = 0, next_out = 0;
+    int err = 0;
+
+    if(uring_init(&u, EOL_URING_ENTRIES) != 0)
+    {
+        return -1;
+    }
+
+    file = calloc(EOL_URING_DEPTH, sizeof(*file));
+    buffers = malloc(EOL_URING_DEPTH * stride);
+    if(file == 0 || buffers == 0)
+    {
+        free(file);
+        free(buffers);
+        uring_exit(&u);
+        return -1;
+    }
+
+    while(next_out < n_files)
+    {
+        /* Start files while there are free slots, in command line order. */
+        while(next_in < n_files && next_in - next_out < EOL_URING_DEPTH)
+        {
+            slot = (size_t)next_in % EOL_URING_DEPTH;
+            f = &file[slot];
+            memset(f, 0, sizeof(*f));
+            f->name = files[next_in++];
+            f->in = buffers + slot * stride;
+            f->out = f->in + EOL_URING_FILE_SIZE;
+
+            uring_sqe(&u, f, slot, IORING_OP_OPENAT, EOL_URING_OPEN_IN,
+                      AT_FDCWD)->addr = (unsigned long long)(uintptr_t)f->name;
+        }
+
+        /* Report the files that are done, in command line order. */
+        f = &file[(size_t)next_out % EOL_URING_DEPTH];
+        if(f->finished && f->pending == 0)
+        {
+            if(f->fallback)
+            {
+                report_to = &f->report;
+                f->err = eol_file(f->name);
+                report_to = 0;
+            }
+            if(f->report.len > 0)
+            {
+                fwrite(f->report.text, 1, f->report.len, stderr);
+            }
+            free(f->report.text);
+            err |= f->err;
+            next_out++;
+            continue;
+        }
+
+        /* Submit the queued requests and wait for at least one. */
+        if(uring_enter(&u, 1) != 0)
+        {
+            break;
+        }
+
+        head = *u.cq_head;
+        while(head != __atomic_load_n(u.cq_tail, __ATOMIC_ACQUIRE))
+        {
+            cqe = &u.cqes[head & u.cq_mask];
+            slot = (size_t)(cqe->user_data >> EOL_URING_OP_BITS);
+            uring_complete(&u, &file[slot], slot,
+                           (int)(cqe->user_data & ((1 << EOL_URING_OP_BITS) - 1)),
+                           cqe->res);
+            head++;
+            __atomic_store_n(u.cq_head, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    if(next_out < n_files)
+    {
+        fprintf(stderr,
+                "Error: Cannot wait for file operations.\n"
+                "       Reason: %s.\n",
+                strerror(errno));
+        err = 1;
+    }
+
+    free(buffers);
+    free(file);
+    uring_exit(&u);
+
+    return err;
+}
+
+#endif /* EOL_URING */
+
+#ifdef EOL_THREADS
+
+/*
+ ------------------------------------------------------------------------------
+ Work-stealing pool for -j.
+
+    The files are sorted largest first and dealt out in turn to one queue
+    per thread, so every queue is sorted largest first too.  A thread takes
+    the files of its own queue from the front.  When its queue is empty, it
+    steals from the back of the fullest other queue, so it takes the small
+    files the owner would have done last.  Each thread counts its own line
+    ends, and the counts are added up when all threads are done.
+ ------------------------------------------------------------------------------
+ */
+
+/* A file of a -j run, with its size when it was scheduled. */
+struct eol_job_file
+{
+    char *name;
+    off_t size;
+    size_t index;               /* position on the command line */
+};
+
+/* The report of a file, kept until the reports before it are written. */
+struct eol_done
+{
+    struct eol_report report;
+    int done;                   /* 1 when handed in, 2 when also written */
+};
+
+/* Bytes of reports held for the reports before them; past it, write them. */
+#ifndef EOL_REPORT_HOLD
+#define EOL_REPORT_HOLD ((size_t)1 << 20)
+#endif /* EOL_REPORT_HOLD */
+
+/* The queue of one thread: files[first + k * stride] for head <= k < tail. */
+struct eol_queue
+{
+    pthread_mutex_t lock;
+    size_t head;
+    size_t tail;
+};
+
+struct eol_pool
+{
+    struct eol_job_file *file;
+    size_t n_files;
+    struct eol_queue *queue;
+    size_t n_queues;
+    pthread_mutex_t report_lock;
+    struct eol_done *done;      /* by position on the command line */
+    size_t next_report;         /* next report to write */
+    size_t held;                /* bytes of the reports held in done */
+    int unordered;              /* reports were written out of order */
+};
+
+/* One thread of the pool and its results. */
+struct eol_worker
+{
+    struct eol_pool *pool;
+    size_t id;
+    int err;
+    double total;
+};
+
+int compare_file_size(const void *a, const void *b)
+{
+    const struct eol_job_file *fa = a;
+    const struct eol_job_file *fb = b;
+
+    /* Largest first; equal sizes in command line order. */
+    if(fa->size != fb->size)
+    {
+        return (fa->size < fb->size) ? 1 : -1;
+    }
+    return (fa->index < fb->index) ? -1 : (fa->index > fb->index);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ finish_report() - Hand in the report of a file.
+
+    Reorder buffer: the report is kept until the reports of all files
+    before it on the command line are in.  Then it is written with every
+    report after it that is in already, and freed.  A file without messages
+    keeps nothing.
+
+    The files are done largest first, so a small file early on the command
+    line can hold back the reports of all the others.  When more than
+    EOL_REPORT_HOLD bytes of reports are held, the reports that are in are
+    written at once, in command line order, without waiting for the ones
+    before them.  A one-line notice says so the first time, so the output
+    is not taken for the usual order.
+ ------------------------------------------------------------------------------
+ */
+
+void write_report(struct eol_pool *pool, struct eol_done *d)
+{
+    if(d->report.len > 0)
+    {
+        fwrite(d->report.text, 1, d->report.len, stderr);
+    }
+    free(d->report.text);
+    pool->held -= d->report.len;
+    d->report.text = 0;
+    d->report.len = 0;
+    d->done = 2;
+}
+
+void finish_report(struct eol_pool *pool, size_t index, struct eol_report *r)
+{
+    struct eol_done *d;
+    size_t i;
+
+    pthread_mutex_lock(&pool->report_lock);
+
+    pool->done[index].report = *r;
+    pool->done[index].done = 1;
+    pool->held += r->len;
+
+    if(pool->held > EOL_REPORT_HOLD)
+    {
+        if(!pool->unordered)
+        {
+            fprintf(stderr, "\nNote: Writing the messages of the files "
+                            "out of command line order.\n");
+            pool->unordered = 1;
+        }
+        for(i = pool->next_report; i < pool->n_files; i++)
+        {
+            if(pool->done[i].done == 1)
+            {
+                write_report(pool, &pool->done[i]);
+            }
+        }
+    }
+
+    while(pool->next_report < pool->n_files &&
+          (d = &pool->done[pool->next_report])->done)
+    {
+        if(d->done == 1)
+        {
+            write_report(pool, d);
+        }
+        pool->next_report++;
+    }
+
+    pthread_mutex_unlock(&pool->report_lock);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ next_file() - Take the next file for thread id, or steal one.
+
+    Returns the index of the file in pool->file, or -1 if none is left.
+ ------------------------------------------------------------------------------
+ */
+
+long next_file(struct eol_pool *pool, size_t id)
+{
+    struct eol_queue *q = &pool->queue[id];
+    size_t victim, left, most, n;
+    long k = -1;
+
+    pthread_mutex_lock(&q->lock);
+    if(q->head < q->tail)
+    {
+        k = (long)(q->head++ * pool->n_queues + id);
+    }
+    pthread_mutex_unlock(&q->lock);
+
+    while(k < 0)
+    {
+        /* Steal from the queue with the most files left. */
+        most = 0;
+        victim = id;
+        for(left = 0; left < pool->n_queues; left++)
+        {
+            q = &pool->queue[left];
+            pthread_mutex_lock(&q->lock);
+            n = q->tail - q->head;
+            pthread_mutex_unlock(&q->lock);
+
+            if(n > most)
+            {
+                most = n;
+                victim = left;
+            }
+        }
+
+        if(most == 0)
+        {
+            return -1;
+        }
+
+        q = &pool->queue[victim];
+        pthread_mutex_lock(&q->lock);
+        if(q->head < q->tail)
+        {
+            k = (long)(--q->tail * pool->n_queues + victim);
+        }
+        pthread_mutex_unlock(&q->lock);
+    }
+
+    return k;
+}
+
+void *eol_worker(void *arg)
+{
+    struct eol_worker *w = arg;
+    struct eol_report r;
+    double before = cnt_grand_total;
+    long k;
+
+    while((k = next_file(w->pool, w->id)) >= 0)
+    {
+        r.text = 0;
+        r.len = 0;
+        r.size = 0;
+
+        report_to = &r;
+        if(eol_file(w->pool->file[k].name) != 0)
+        {
+            w->err = 1;
+        }
+        report_to = 0;
+
+        finish_report(w->pool, w->pool->file[k].index, &r);
+    }
+
+    w->total = cnt_grand_total - before;
+
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_files() - Set or scan the EOL characters of files on jobs threads.
+
+    The line ends are added to cnt_grand_total of the calling thread.
+    Returns 0, or 1 if any file had an error.
+ ------------------------------------------------------------------------------
+ */
+
+int eol_files(char **files, int n_files, int jobs)
+{
+    struct eol_pool pool;
+    struct eol_worker *worker;
+    pthread_t *thread;
+    struct stat sb;
+    size_t i, started;
+    int err = 0;
+
+    if(jobs > n_files)
+    {
+        jobs = n_files;
+    }
+
+    pool.n_files = (size_t)n_files;
+    pool.n_queues = (size_t)jobs;
+    pool.file = malloc(pool.n_files * sizeof(*pool.file));
+    pool.queue = malloc(pool.n_queues * sizeof(*pool.queue));
+    pool.done = calloc(pool.n_files, sizeof(*pool.done));
+    pool.next_report = 0;
+    pool.held = 0;
+    pool.unordered = 0;
+    worker = calloc(pool.n_queues, sizeof(*worker));
+    thread = malloc(pool.n_queues * sizeof(*thread));
+
+    if(pool.file == 0 || pool.queue == 0 || pool.done == 0 ||
+       worker == 0 || thread == 0)
+    {
+        free(pool.file);
+        free(pool.queue);
+        free(pool.done);
+        free(worker);
+        free(thread);
+
+        /* Do them one at a time instead. */
+        for(i = 0; i < (size_t)n_files; i++)
+        {
+            if(eol_file(files[i]) != 0)
+            {
+                err = 1;
+            }
+        }
+        return err;
+    }
+
+    /* Largest first: a file that cannot be stat()ed is reported later. */
+    for(i = 0; i < pool.n_files; i++)
+    {
+        pool.file[i].name = files[i];
+        pool.file[i].size = (stat(files[i], &sb) == 0) ? sb.st_size : 0;
+        pool.file[i].index = i;
+    }
+    qsort(pool.file, pool.n_files, sizeof(*pool.file), compare_file_size);
+    pthread_mutex_init(&pool.report_lock, 0);
+
+    /* Deal the files out in turn. */
+    for(i = 0; i < pool.n_queues; i++)
+    {
+        pthread_mutex_init(&pool.queue[i].lock, 0);
+        pool.queue[i].head = 0;
+        pool.queue[i].tail = (pool.n_files - i + pool.n_queues - 1) /
+                             pool.n_queues;
+        worker[i].pool = &pool;
+        worker[i].id = i;
+    }
+
+    /* This thread is worker 0. */
+    for(started = 1; started < pool.n_queues; started++)
+    {
+        if(pthread_create(&thread[started], 0, eol_worker,
+                          &worker[started]) != 0)
+        {
+            break;
+        }
+    }
+
+    /* The files of threads that did not start are stolen by the others. */
+    eol_worker(&worker[0]);
+
+    for(i = 1; i < started; i++)
+    {
+        pthread_join(thread[i], 0);
+    }
+
+    /* Worker 0 counted into this thread already. */
+    err = worker[0].err;
+    for(i = 1; i < started; i++)
+    {
+        cnt_grand_total += worker[i].total;
+        err |= worker[i].err;
+    }
+
+    for(i = 0; i < pool.n_queues; i++)
+    {
+        pthread_mutex_destroy(&pool.queue[i].lock);
+    }
+    pthread_mutex_destroy(&pool.report_lock);
+
+    free(pool.file);
+    free(pool.queue);
+    free(pool.done);
+    free(worker);
+    free(thread);
+
+    return err;
+}
+
+#endif /* EOL_THREADS */
+
+/*
+ ------------------------------------------------------------------------------
+ set_eol() - Set EOL characters.
+
+    IN     FMT                      OUT         Eat
+    --     ---                      ---         ---
+    CR     EOL_MSDOS_OUTPUT_FORMAT  CR + LF     single LF after the CR, if any
+    CR     EOL_MAC_OUTPUT_FORMAT    CR          single LF after the CR, if any
+    CR     EOL_UNIX_OUTPUT_FORMAT   LF          single LF after the CR, if any
+    LF     EOL_MSDOS_OUTPUT_FORMAT  CR + LF     nothing
+    LF     EOL_MAC_OUTPUT_FORMAT    CR          nothing
+    LF     EOL_UNIX_OUTPUT_FORMAT   LF          nothing
+ ------------------------------------------------------------------------------
+ */
+
+unsigned long set_eol(FILE *file_in, FILE *file_out, struct eol_counts *cnt)
+{
+    int n;
+    int fd_in = fileno(file_in);
+    int fd_out = fileno(file_out);
+    size_t len;
+    unsigned long nl = 0L;
+    struct eol_ctx *ctx;
+
+#ifdef EOL_MMAP
+    /* Convert a regular file straight into a mapped output file, if possible. */
+    if(set_mapped(fd_in, fd_out, cnt, &nl) == 0)
+    {
+        return nl;
+    }
+#endif /* EOL_MMAP */
+
+    if((ctx = eol_new(output_format)) == 0)
+    {
+        report("Error: Out of memory.\n");
+        io_error = 1;
+        return 0L;
+    }
+
+    /* Read the file one block at a time. */
+    n = read_block(fd_in, block_in, EOL_BLOCK_SIZE);
+
+    while(n > 0)
+    {
+        /* Convert the block and write it. */
+        len = eol_feed(ctx, block_in, (size_t)n, block_out);
+
+        if(write_block(fd_out, block_out, len) != 0)
+        {
+            break;
+        }
+
+        n = read_block(fd_in, block_in, EOL_BLOCK_SIZE);
+    }
+    /* End of while loop reading input file. */
+
+    eol_finish(ctx);
+    nl = eol_line_ends(ctx);
+    kernel_used = eol_kernel_name(ctx);
+    eol_free(ctx);
+
+    /* Return the number of end-of-lines processed. */
+    return nl;
+}
+
+
+/*
+ ------------------------------------------------------------------------------
+ prescan() - Count the line ends of an input file before setting them.
+
+    Counts from the current offset to the end of a regular file, with a CR
+    at EOF counted as Macintosh, and leaves the offset where it was.
+    Returns 0, or -1 if the input cannot be scanned without consuming it.
+ ------------------------------------------------------------------------------
+ */
+
+int prescan(FILE *file_in, struct eol_counts *cnt)
+{
+#ifdef EOL_MMAP
+    int fd_in = fileno(file_in);
+    off_t start = lseek(fd_in, 0, SEEK_CUR);
+
+    if(start < 0 || scan_mapped(fd_in, cnt) != 0)
+    {
+        return -1;
+    }
+
+    lseek(fd_in, start, SEEK_SET);
+
+    if(io_error)
+    {
+        return -1;
+    }
+
+    return 0;
+#else
+    return -1;
+#endif /* EOL_MMAP */
+}
+
+
+/*
+ ------------------------------------------------------------------------------
+ set_eol_in_place() - Set EOL characters in a file without a temporary file.
+
+    file must be open for reading and writing at its start.  cnt holds the
+    line ends counted by prescan(), or is 0 if they were not counted.
+    Returns 0 when the file was converted, with the number of line ends in
+    *nl, or -1 if it cannot be converted in place, in which case it has not
+    been changed.  Errors while converting set io_error.
+ ------------------------------------------------------------------------------
+ */
+
+int set_eol_in_place(FILE *file, struct eol_counts *cnt, unsigned long *nl)
+{
+#ifdef EOL_IN_PLACE
+    int fd = fileno(file);
+    struct stat sb;
+
+    if(fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode))
+    {
+        return -1;
+    }
+
+    /*
+     Without CR+LF pairs, converting between UNIX and Macintosh replaces
+     each lone CR by an LF or each LF by a CR, and nothing else changes.
+     */
+    if(cnt != 0 && cnt->cnt_msdos == 0 &&
+       (output_format == EOL_UNIX_OUTPUT_FORMAT ||
+        output_format == EOL_MAC_OUTPUT_FORMAT))
+    {
+        if(substitute_in_place(fd, sb.st_size,
+                               output_format == EOL_UNIX_OUTPUT_FORMAT ? '\r' : '\n',
+                               output_format == EOL_UNIX_OUTPUT_FORMAT ? '\n' : '\r') == 0)
+        {
+            kernel_used = eol_selected_kernels();
+            *nl = cnt->cnt_mac + cnt->cnt_unix;
+            return 0;
+        }
+    }
+
+    switch(output_format)
+    {
+        case EOL_UNIX_OUTPUT_FORMAT:
+        case EOL_MAC_OUTPUT_FORMAT:
+            /* The output is never longer than the input. */
+            return shrink_in_place(fd, nl);
+        case EOL_MSDOS_OUTPUT_FORMAT:
+            /* The output is longer; its size must be known beforehand. */
+            if(cnt == 0)
+            {
+                return -1;
+            }
+            return expand_in_place(fd, sb.st_size, cnt, nl);
+        default:
+            return -1;
+    }
+#else
+    return -1;
+#endif /* EOL_IN_PLACE */
+}
+
+#ifdef EOL_IN_PLACE
+
+/*
+ ------------------------------------------------------------------------------
+ shrink_in_place() - Set UNIX or Macintosh EOL characters in place.
+
+    The output is never longer than the input, so the converted blocks are
+    written back at a write offset that trails the read offset: each block
+    is read before any of its bytes can be overwritten.  At the end the
+    file is truncated to the length of the output.
+ ------------------------------------------------------------------------------
+ */
+
+int shrink_in_place(int fd, unsigned long *nl)
+{
+    struct eol_ctx *ctx;
+    off_t r = 0, w = 0;
+    size_t len;
+    int n;
+
+    if((ctx = eol_new(output_format)) == 0)
+    {
+        return -1;
+    }
+
+    while((n = pread_block(fd, block_in, EOL_BLOCK_SIZE, r)) > 0)
+    {
+        len = eol_feed(ctx, block_in, (size_t)n, block_out);
+
+        if(pwrite_block(fd, block_out, len, w) != 0)
+        {
+            break;
+        }
+
+        r += n;
+        w += (off_t)len;
+    }
+
+    if(!io_error && ftruncate(fd, w) != 0)
+    {
+        report("Error: Cannot truncate output.\n"
+               "       Reason: %s.\n",
+               strerror(errno));
+        io_error = 1;
+    }
+
+    *nl = eol_line_ends(ctx);
+    kernel_used = eol_kernel_name(ctx);
+    eol_free(ctx);
+
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ expand_in_place() - Set MS-DOS EOL characters in place.
+
+    cnt holds the line ends of the file, so the size of the output is known.
+    The file is grown to that size first, and then converted one block at a
+    time from its end back to its start.  The output of a block never ends
+    before the block starts, so the write offset stays ahead of the read
+    offset and no byte is overwritten before it has been read.  The byte
+    before each block is read with it, to carry a CR into the block.
+    Returns 0, or -1 if the file cannot be grown, in which case it has not
+    been changed.
+ ------------------------------------------------------------------------------
+ */
+
+int expand_in_place(int fd, off_t size, struct eol_counts *cnt,
+                    unsigned long *nl)
+{
+    struct eol_ctx *ctx;
+    off_t r = size, w, start;
+    size_t n, skip, len;
+    int error;
+
+    w = (off_t)eol_converted_size(EOL_MSDOS, size, cnt);
+
+    if((ctx = eol_new(EOL_MSDOS)) == 0)
+    {
+        return -1;
+    }
+
+    /*
+     Give the file its final size, and the space for it, before any byte is
+     moved.  Where blocks cannot be allocated ahead, the new end is written
+     with zeros, so running out of space cannot stop the backward pass.
+     */
+    switch(allocate_file(fd, size, w))
+    {
+        case 0:
+            error = (ftruncate(fd, w) != 0);
+            break;
+        case 1:
+            memset(block_out, 0, EOL_BLOCK_SIZE);
+            for(start = size, error = 0; start < w && !error; start += len)
+            {
+                len = (w - start > EOL_BLOCK_SIZE) ? EOL_BLOCK_SIZE
+                                                   : (size_t)(w - start);
+                error = (pwrite(fd, block_out, len, start) != (ssize_t)len);
+            }
+            break;
+        default:
+            error = 1;
+            break;
+    }
+
+    if(error)
+    {
+        ftruncate(fd, size);
+        eol_free(ctx);
+        return -1;
+    }
+
+    while(r > 0)
+    {
+        /* Read the block ending at r, with the byte before it if any. */
+        n = (r > EOL_BLOCK_SIZE) ? EOL_BLOCK_SIZE : (size_t)r;
+        start = r - (off_t)n;
+        skip = (start > 0) ? 1 : 0;
+
+        if(pread_block(fd, block_in, n, start) != (int)n)
+        {
+            if(!io_error)
+            {
+                report("Error: Cannot read input.\n"
+                       "       Reason: File changed while being converted.\n");
+                io_error = 1;
+            }
+            break;
+        }
+
+        eol_carry_cr(ctx, skip && block_in[0] == '\r');
+        len = eol_feed(ctx, block_in + skip, n - skip, block_out);
+
+        /* The counts are stale if the output would overwrite unread bytes. */
+        if(w - (off_t)len < start + (off_t)skip)
+        {
+            report("Error: Cannot write output.\n"
+                   "       Reason: File changed while being converted.\n");
+            io_error = 1;
+            break;
+        }
+
+        w -= (off_t)len;
+
+        if(pwrite_block(fd, block_out, len, w) != 0)
+        {
+            break;
+        }
+
+        r = start + (off_t)skip;
+    }
+
+    if(!io_error && w != 0)
+    {
+        report("Error: Cannot write output.\n"
+               "       Reason: File changed while being converted.\n");
+        io_error = 1;
+    }
+
+    *nl = eol_line_ends(ctx);
+    kernel_used = eol_kernel_name(ctx);
+    eol_free(ctx);
+
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ substitute_in_place() - Replace one line end character by the other.
+
+    The file is mapped for writing one window of up to EOL_MAP_BUDGET bytes
+    at a time, and the substitution kernel stores only where a byte
+    changes, so only the pages with line ends are written back.
+    Returns 0, or -1 if the file cannot be mapped, in which case it has not
+    been changed.
+ ------------------------------------------------------------------------------
+ */
+
+int substitute_in_place(int fd, off_t size, unsigned char from,
+                        unsigned char to)
+{
+    struct eol_map map;
+    off_t offset = 0;
+    size_t len;
+
+    while(offset < size)
+    {
+        len = (size - offset > (off_t)EOL_MAP_BUDGET) ? EOL_MAP_BUDGET
+                                                      : (size_t)(size - offset);
+
+        if(map_file(fd, offset, len, PROT_READ | PROT_WRITE, &map) != 0)
+        {
+            if(offset == 0)
+            {
+                return -1;
+            }
+
+            report("Error: Cannot map output.\n"
+                   "       Reason: %s.\n",
+                   strerror(errno));
+            io_error = 1;
+            return 0;
+        }
+
+        madvise(map.base, map.base_len, MADV_SEQUENTIAL);
+
+        eol_substitute(map.data, map.len, from, to);
+
+        unmap_file(&map);
+        offset += (off_t)len;
+    }
+
+    return 0;
+}
+
+#endif /* EOL_IN_PLACE */
+
+/*
+ ------------------------------------------------------------------------------
+ scan_eol() - Scan for EOL characters.
+
+    IN         FMT
+    -------    ------------
+    CR + LF    MS-DOS
+    CR         Macintosh
+    LF         UNIX
+ ------------------------------------------------------------------------------
+ */
+
+unsigned long scan_eol(FILE *file_in)
+{
+    int n;
+    int fd_in = fileno(file_in);
+    struct eol_counts st;
+    struct eol_ctx *ctx;
+
+#ifdef EOL_MMAP
+    /* Scan a regular file straight from memory, if it can be mapped. */
+    if(scan_mapped(fd_in, &st) != 0)
+#endif /* EOL_MMAP */
+    {
+        if((ctx = eol_new(EOL_SCAN)) == 0)
+        {
+            report("Error: Out of memory.\n");
+            io_error = 1;
+            return 0L;
+        }
+
+        /* Read the file one block at a time. */
+        n = read_block(fd_in, block_in, EOL_BLOCK_SIZE);
+
+        while(n > 0)
+        {
+            eol_feed(ctx, block_in, (size_t)n, 0);
+
+            n = read_block(fd_in, block_in, EOL_BLOCK_SIZE);
+        }
+        /* End of while loop reading input file. */
+
+        /* A CR at EOF has no LF after it: eol_finish() counts it. */
+        eol_finish(ctx);
+        eol_get_counts(ctx, &st);
+        kernel_used = eol_kernel_name(ctx);
+        eol_free(ctx);
+    }
+
+    cnt_msdos += st.cnt_msdos;
+    cnt_mac += st.cnt_mac;
+    cnt_unix += st.cnt_unix;
+
+    /* Return the number of end-of-lines processed. */
+    return st.cnt_msdos + st.cnt_mac + st.cnt_unix;
+}
+
+
+#ifdef EOL_IN_PLACE
+
+/*
+ ------------------------------------------------------------------------------
+ pread_block() - Read up to size bytes at an offset of a file.
+
+    Returns the number of bytes read, 0 at EOF or -1 on error.
+ ------------------------------------------------------------------------------
+ */
+
+int pread_block(int fd, unsigned char *buf, size_t size, off_t offset)
+{
+    int n;
+
+    do
+    {
+        n = (int)pread(fd, buf, size, offset);
+    } while(n < 0 && errno == EINTR);
+
+    if(n < 0)
+    {
+        report("Error: Cannot read input.\n"
+               "       Reason: %s.\n",
+               strerror(errno));
+        io_error = 1;
+    }
+
+    return n;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ pwrite_block() - Write len bytes at an offset of a file.
+
+    Returns 0 when all bytes were written or -1 on error.
+ ------------------------------------------------------------------------------
+ */
+
+int pwrite_block(int fd, const unsigned char *buf, size_t len, off_t offset)
+{
+    int n;
+
+    while(len > 0)
+    {
+        n = (int)pwrite(fd, buf, len, offset);
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            report("Error: Cannot write output.\n"
+                   "       Reason: %s.\n",
+                   strerror(errno));
+            io_error = 1;
+            return -1;
+        }
+
+        buf += n;
+        len -= (size_t)n;
+        offset += n;
+    }
+
+    return 0;
+}
+
+#endif /* EOL_IN_PLACE */
+
+#ifdef EOL_MMAP
+
+/*
+ ------------------------------------------------------------------------------
+ map_file() - Map len bytes of a file, starting at offset.
+
+    The mapping starts at the page boundary at or below offset, and
+    map->data points at offset.  prot is PROT_READ for input, or
+    PROT_READ | PROT_WRITE for a shared output mapping.
+    Returns 0, or -1 if the file cannot be mapped.
+ ------------------------------------------------------------------------------
+ */
+
+int map_file(int fd, off_t offset, size_t len, int prot, struct eol_map *map)
+{
+    off_t page = (off_t)sysconf(_SC_PAGESIZE);
+    off_t start = offset - offset % page;
+    size_t skip = (size_t)(offset - start);
+
+    map->base_len = len + skip;
+    map->base = mmap(0, map->base_len, prot, MAP_SHARED, fd, start);
+    if(map->base == MAP_FAILED)
+    {
+        map->base = 0;
+        return -1;
+    }
+
+    map->data = (unsigned char *)map->base + skip;
+    map->len = len;
+
+    return 0;
+}
+
+void unmap_file(struct eol_map *map)
+{
+    if(map->base != 0)
+    {
+        munmap(map->base, map->base_len);
+        map->base = 0;
+    }
+}
+
+/*
+ ------------------------------------------------------------------------------
+ allocate_file() - Allocate the blocks of a file from offset from to to.
+
+    A file grown with ftruncate() alone is sparse, and on a full filesystem
+    a store into a mapping of it raises SIGBUS.  Returns 0 when the blocks
+    are allocated, 1 if the filesystem cannot allocate blocks ahead, or -1
+    with errno set if they cannot be allocated, as when there is no space.
+    The size of the file may have changed when it returns -1.
+ ------------------------------------------------------------------------------
+ */
+
+int allocate_file(int fd, off_t from, off_t to)
+{
+#ifdef __linux__
+    if(to <= from || fallocate(fd, 0, from, to - from) == 0)
+    {
+        return 0;
+    }
+
+    return (errno == EOPNOTSUPP || errno == ENOSYS) ? 1 : -1;
+#else
+    return 1;
+#endif /* __linux__ */
+}
+
+/*
+ ------------------------------------------------------------------------------
+ scan_mapped() - Scan a regular file from memory.
+
+    Counts from the current file offset to the end of the file, one window
+    of up to EOL_MAP_BUDGET bytes at a time, with a CR at EOF counted as
+    Macintosh.  Returns 0, or -1 if fd is not a regular file or cannot be
+    mapped, in which case nothing has been scanned.
+ ------------------------------------------------------------------------------
+ */
+
+int scan_mapped(int fd, struct eol_counts *cnt)
+{
+    struct stat sb;
+    struct eol_map map;
+    struct eol_ctx *ctx;
+    off_t start, offset, end;
+    size_t len;
+
+    if(fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode) ||
+       (start = lseek(fd, 0, SEEK_CUR)) < 0)
+    {
+        return -1;
+    }
+
+    end = sb.st_size;
+    offset = start;
+
+#ifdef EOL_THREADS
+    forget_chunks();
+
+    if(scan_parallel(fd, start, end, cnt) == 0)
+    {
+        lseek(fd, end, SEEK_SET);
+        return 0;
+    }
+#endif /* EOL_THREADS */
+
+    if((ctx = eol_new(EOL_SCAN)) == 0)
+    {
+        return -1;
+    }
+
+    while(offset < end)
+    {
+        len = (end - offset > (off_t)EOL_MAP_BUDGET) ? EOL_MAP_BUDGET
+                                                     : (size_t)(end - offset);
+
+        if(map_file(fd, offset, len, PROT_READ, &map) != 0)
+        {
+            if(offset == start)
+            {
+                /* Nothing scanned yet: read the file instead. */
+                eol_free(ctx);
+                return -1;
+            }
+
+            report("Error: Cannot map input.\n"
+                   "       Reason: %s.\n",
+                   strerror(errno));
+            io_error = 1;
+            break;
+        }
+
+        madvise(map.base, map.base_len, MADV_SEQUENTIAL);
+
+        eol_feed(ctx, map.data, map.len, 0);
+
+        unmap_file(&map);
+        offset += (off_t)len;
+    }
+
+    eol_finish(ctx);
+    eol_get_counts(ctx, cnt);
+    kernel_used = eol_kernel_name(ctx);
+    eol_free(ctx);
+
+    /* Leave the file offset at the end, as reading would. */
+    if(offset == end)
+    {
+        lseek(fd, end, SEEK_SET);
+    }
+
+    return 0;
+}
+
+#ifdef EOL_THREADS
+
+/* One chunk of a parallel scan or conversion. */
+struct eol_chunk
+{
+    off_t offset;
+    size_t len;
+    struct eol_counts cnt;      /* counts of the chunk alone */
+    int lf_first;               /* the chunk starts with an LF */
+    int prev_cr;                /* the chunk before ends with a CR */
+    off_t out_offset;           /* where the output of the chunk starts */
+    size_t out_len;             /* length of the output of the chunk */
+    unsigned long nl;           /* line ends converted in the chunk */
+    const char *kernel;         /* kernels that scanned or converted it */
+    int error;                  /* errno if the chunk could not be done */
+};
+
+/* The chunks of a parallel scan or conversion, shared by its threads. */
+struct eol_chunk_job
+{
+    int fd;
+    int fd_out;
+    int format;
+    struct eol_chunk *chunk;
+    size_t n_chunks;
+    size_t next;                /* next chunk to work on */
+    long n_threads;
+    dev_t dev;                  /* the file scanned, from start to end */
+    ino_t ino;
+    off_t start;
+    off_t end;
+};
+
+/*
+ The chunks of the last parallel scan of this thread in set mode, kept so
+ that set_parallel() can size the output of the same file from their counts
+ instead of scanning it again.  chunk is 0 if there are none.
+ */
+EOL_THREAD_LOCAL struct eol_chunk_job scanned;
+
+/*
+ ------------------------------------------------------------------------------
+ split_chunks() - Split the bytes of a file from start to end into chunks.
+
+    Returns the number of threads to use, or 0 if there is only one CPU,
+    the file is smaller than two chunks, or there is no memory for them.
+ ------------------------------------------------------------------------------
+ */
+
+long split_chunks(struct eol_chunk_job *job, off_t start, off_t end)
+{
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct eol_chunk *c;
+    size_t i;
+
+    if(n_threads < 2 || end - start < 2 * (off_t)EOL_CHUNK_SIZE)
+    {
+        return 0;
+    }
+
+    job->n_chunks = (size_t)((end - start + EOL_CHUNK_SIZE - 1) /
+                             EOL_CHUNK_SIZE);
+    job->next = 0;
+    job->chunk = calloc(job->n_chunks, sizeof(*job->chunk));
+    if(job->chunk == 0)
+    {
+        return 0;
+    }
+
+    for(i = 0; i < job->n_chunks; i++)
+    {
+        c = &job->chunk[i];
+        c->offset = start + (off_t)i * (off_t)EOL_CHUNK_SIZE;
+        c->len = (end - c->offset > (off_t)EOL_CHUNK_SIZE)
+                     ? EOL_CHUNK_SIZE : (size_t)(end - c->offset);
+    }
+
+    return ((size_t)n_threads < job->n_chunks) ? n_threads
+                                                : (long)job->n_chunks;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ run_chunks() - Work on the chunks of a job on n_threads threads.
+
+    This thread works too, so one thread less is started.  If threads
+    cannot be started, the threads that run do all the chunks.
+ ------------------------------------------------------------------------------
+ */
+
+void run_chunks(struct eol_chunk_job *job, long n_threads,
+                void *(*work)(void *))
+{
+    pthread_t thread[64];
+    long started, i;
+
+    if(n_threads > (long)(sizeof(thread) / sizeof(thread[0])) + 1)
+    {
+        n_threads = (long)(sizeof(thread) / sizeof(thread[0])) + 1;
+    }
+
+    job->next = 0;
+
+    for(started = 0; started < n_threads - 1; started++)
+    {
+        if(pthread_create(&thread[started], 0, work, job) != 0)
+        {
+            break;
+        }
+    }
+
+    work(job);
+
+    for(i = 0; i < started; i++)
+    {
+        pthread_join(thread[i], 0);
+    }
+}
+
+/*
+ ------------------------------------------------------------------------------
+ scan_chunks() - Scan chunks of a file until none are left.
+
+    Thread function of scan_parallel().  Each chunk is scanned from its own
+    mapping as if it started a file, and scan_parallel() fixes up the line
+    ends that straddle two chunks.
+ ------------------------------------------------------------------------------
+ */
+
+void *scan_chunks(void *arg)
+{
+    struct eol_chunk_job *job = arg;
+    struct eol_chunk *c;
+    struct eol_map map;
+    struct eol_ctx *ctx = eol_new(EOL_SCAN);
+    size_t i;
+
+    while((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED))
+          < job->n_chunks)
+    {
+        c = &job->chunk[i];
+
+        if(ctx == 0)
+        {
+            c->error = ENOMEM;
+            continue;
+        }
+
+        if(map_file(job->fd, c->offset, c->len, PROT_READ, &map) != 0)
+        {
+            c->error = errno;
+            continue;
+        }
+
+        madvise(map.base, map.base_len, MADV_SEQUENTIAL);
+
+        c->lf_first = (map.data[0] == '\n');
+        eol_reset(ctx);
+        eol_feed(ctx, map.data, map.len, 0);
+        eol_get_counts(ctx, &c->cnt);
+        c->kernel = eol_kernel_name(ctx);
+
+        unmap_file(&map);
+    }
+
+    eol_free(ctx);
+
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ scan_parallel() - Scan a regular file on several threads.
+
+    Splits the bytes from start to end into chunks of EOL_CHUNK_SIZE bytes
+    and scans them on up to one thread per online CPU.  The counts of the
+    chunks are then added in order.  A CR at the end of a chunk is carried
+    into the next chunk: followed by an LF, the LF the next chunk counted as
+    UNIX becomes an MS-DOS pair, otherwise the CR counts as Macintosh, as
+    does a CR at EOF.  The totals match a scan on one thread exactly.
+    Returns 0, or -1 if the file is too small, in which case nothing has
+    been scanned.
+ ------------------------------------------------------------------------------
+ */
+
+int scan_parallel(int fd, off_t start, off_t end, struct eol_counts *cnt)
+{
+    struct eol_chunk_job job;
+    struct eol_chunk *c;
+    struct eol_counts chunk_cnt;
+    struct stat sb;
+    long n_threads;
+    size_t i;
+    int prev_cr = 0, error = 0;
+
+    if((n_threads = split_chunks(&job, start, end)) == 0)
+    {
+        return -1;
+    }
+
+    job.fd = fd;
+    run_chunks(&job, n_threads, scan_chunks);
+
+    /* Add the counts in order, joining line ends across chunks. */
+    memset(cnt, 0, sizeof(*cnt));
+    kernel_used = job.chunk[0].kernel;
+
+    for(i = 0; i < job.n_chunks; i++)
+    {
+        c = &job.chunk[i];
+
+        if(c->error != 0)
+        {
+            error = c->error;
+            break;
+        }
+
+        /* The counts of the chunk alone are kept for set_parallel(). */
+        chunk_cnt = c->cnt;
+
+        if(prev_cr)
+        {
+            if(c->lf_first)
+            {
+                chunk_cnt.cnt_unix--;
+                chunk_cnt.cnt_msdos++;
+            }
+            else
+            {
+                chunk_cnt.cnt_mac++;
+            }
+        }
+
+        cnt->cnt_msdos += chunk_cnt.cnt_msdos;
+        cnt->cnt_mac += chunk_cnt.cnt_mac;
+        cnt->cnt_unix += chunk_cnt.cnt_unix;
+        prev_cr = chunk_cnt.prev_cr;
+    }
+
+    /* A CR at EOF has no LF after it: Count it as Macintosh. */
+    if(prev_cr && error == 0)
+    {
+        cnt->cnt_mac++;
+    }
+
+    /* Keep the chunks of a file that is about to be set. */
+    if(error == 0 && operation == EOL_SET_OPERATION && fstat(fd, &sb) == 0)
+    {
+        forget_chunks();
+        job.n_threads = n_threads;
+        job.dev = sb.st_dev;
+        job.ino = sb.st_ino;
+        job.start = start;
+        job.end = end;
+        scanned = job;
+    }
+    else
+    {
+        free(job.chunk);
+    }
+
+    if(error != 0)
+    {
+        report("Error: Cannot map input.\n"
+               "       Reason: %s.\n",
+               strerror(error));
+        io_error = 1;
+    }
+
+    return 0;
+}
+
+/* Free the chunks kept by scan_parallel(). */
+void forget_chunks(void)
+{
+    free(scanned.chunk);
+    scanned.chunk = 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ set_chunks() - Convert chunks of a file until none are left.
+
+    Thread function of set_parallel().  Each chunk is converted from its own
+    input mapping into its own region of the output, starting with the CR
+    carried from the chunk before it.
+ ------------------------------------------------------------------------------
+ */
+
+void *set_chunks(void *arg)
+{
+    struct eol_chunk_job *job = arg;
+    struct eol_chunk *c;
+    struct eol_map map_in, map_out;
+    struct eol_ctx *ctx = eol_new(job->format);
+    size_t i;
+
+    while((i = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED))
+          < job->n_chunks)
+    {
+        c = &job->chunk[i];
+
+        if(ctx == 0)
+        {
+            c->error = ENOMEM;
+            continue;
+        }
+
+        if(map_file(job->fd, c->offset, c->len, PROT_READ, &map_in) != 0)
+        {
+            c->error = errno;
+            continue;
+        }
+
+        /* A chunk of nothing but the LF of a pair has no output. */
+        map_out.base = 0;
+        map_out.data = 0;
+        if(c->out_len > 0 &&
+           map_file(job->fd_out, c->out_offset, c->out_len,
+                    PROT_READ | PROT_WRITE, &map_out) != 0)
+        {
+            c->error = errno;
+            unmap_file(&map_in);
+            continue;
+        }
+
+        madvise(map_in.base, map_in.base_len, MADV_SEQUENTIAL);
+        if(map_out.base != 0)
+        {
+            madvise(map_out.base, map_out.base_len, MADV_SEQUENTIAL);
+        }
+
+        eol_reset(ctx);
+        eol_carry_cr(ctx, c->prev_cr);
+
+        if(c->out_len > 0)
+        {
+            c->out_len = eol_feed_exact(ctx, map_in.data, map_in.len,
+                                        map_out.data);
+        }
+        c->nl = eol_line_ends(ctx);
+        c->kernel = eol_kernel_name(ctx);
+
+        unmap_file(&map_out);
+        unmap_file(&map_in);
+    }
+
+    eol_free(ctx);
+
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ set_parallel() - Convert a regular file into a mapped output on several
+                  threads.
+
+    The chunks are scanned in parallel first, unless the chunks of the
+    same file were kept by the scan that counted its line ends for the
+    caller.  The output length of each
+    chunk follows from its counts and from the CR carried into it, and an
+    exclusive prefix sum of those lengths gives each chunk its output
+    offset.  The chunks are then converted in parallel into their own
+    regions of the output, which has already been given its final size.  A
+    CR+LF pair split between two chunks is converted once, by the chunk
+    with the CR; the chunk with the LF starts with the CR carried in and
+    eats the LF, as the serial conversion does.
+    Returns 0, or -1 if the file is too small or the chunks do not add up
+    to the output size, in which case nothing has been written.
+ ------------------------------------------------------------------------------
+ */
+
+int set_parallel(int fd_in, off_t in_start, off_t in_end,
+                 int fd_out, off_t out_base, off_t out_end,
+                 int format, unsigned long *nl)
+{
+    struct eol_chunk_job job;
+    struct eol_chunk *c;
+    struct eol_counts cnt;
+    struct stat sb;
+    long n_threads;
+    off_t out_off;
+    size_t i;
+    int prev_cr, error = 0;
+
+    if(scanned.chunk != 0 && scanned.fd == fd_in &&
+       scanned.start == in_start && scanned.end == in_end &&
+       fstat(fd_in, &sb) == 0 &&
+       scanned.dev == sb.st_dev && scanned.ino == sb.st_ino)
+    {
+        /* Counted by the scan before, so the file is read only once more. */
+        job = scanned;
+        scanned.chunk = 0;
+        n_threads = job.n_threads;
+    }
+    else
+    {
+        forget_chunks();
+
+        if((n_threads = split_chunks(&job, in_start, in_end)) == 0)
+        {
+            return -1;
+        }
+
+        job.fd = fd_in;
+        run_chunks(&job, n_threads, scan_chunks);
+    }
+
+    job.fd_out = fd_out;
+    job.format = format;
+
+    /* Output length and offset of each chunk. */
+    prev_cr = 0;
+    out_off = out_base;
+
+    for(i = 0; i < job.n_chunks; i++)
+    {
+        c = &job.chunk[i];
+
+        if(c->error != 0)
+        {
+            free(job.chunk);
+            return -1;
+        }
+
+        /* Every CR of the chunk is converted, even one at its end. */
+        cnt = c->cnt;
+        cnt.cnt_mac += (unsigned long)cnt.prev_cr;
+
+        c->prev_cr = prev_cr;
+        c->out_offset = out_off;
+        c->out_len = (size_t)eol_converted_size(job.format, (long long)c->len,
+                                                &cnt);
+
+        /* The LF of a pair split from its CR is eaten. */
+        if(prev_cr && c->lf_first)
+        {
+            c->out_len -= (job.format == EOL_MSDOS_OUTPUT_FORMAT) ? 2 : 1;
+        }
+
+        out_off += (off_t)c->out_len;
+        prev_cr = c->cnt.prev_cr;
+    }
+
+    if(out_off != out_end)
+    {
+        free(job.chunk);
+        return -1;
+    }
+
+    run_chunks(&job, n_threads, set_chunks);
+
+    /* Check that each chunk filled its region, in order. */
+    out_off = out_base;
+
+    for(i = 0; i < job.n_chunks; i++)
+    {
+        c = &job.chunk[i];
+
+        if(c->error != 0)
+        {
+            error = c->error;
+            break;
+        }
+        if(c->out_offset != out_off)
+        {
+            error = EIO;
+            break;
+        }
+
+        *nl += c->nl;
+        out_off += (off_t)c->out_len;
+    }
+
+    kernel_used = job.chunk[0].kernel;
+
+    free(job.chunk);
+
+    if(error != 0 || out_off != out_end)
+    {
+        report("Error: Cannot convert input through memory mappings.\n"
+               "       Reason: %s.\n",
+               error != 0 ? strerror(error) : "The input changed");
+        io_error = 1;
+    }
+
+    return 0;
+}
+
+#endif /* EOL_THREADS */
+
+/*
+ ------------------------------------------------------------------------------
+ set_mapped() - Set EOL characters from a mapped file into a mapped file.
+
+    Used when the input and the output are both regular files and the
+    output is written at its end.  The input is scanned first, unless cnt
+    holds its line ends already, which gives the exact size of the output.
+    The output file is extended to that size (and its blocks allocated,
+    where the system can) in one step, mapped, and the input is converted
+    straight from its mapping into the output mapping, one window of up to
+    EOL_MAP_BUDGET input bytes at a time.  The line ends converted are
+    added to *nl.
+    Returns 0, or -1 if the files cannot be mapped, in which case nothing
+    has been read or written.
+ ------------------------------------------------------------------------------
+ */
+
+int set_mapped(int fd_in, int fd_out, struct eol_counts *cnt,
+               unsigned long *nl)
+{
+    struct stat sb_in, sb_out;
+    struct eol_counts counted;
+    struct eol_map map_in, map_out;
+    struct eol_ctx *ctx;
+    off_t in_start, in_off, in_serial, out_base, out_end, out_off;
+    size_t len, out_len;
+
+    if(fstat(fd_in, &sb_in) != 0 || !S_ISREG(sb_in.st_mode) ||
+       fstat(fd_out, &sb_out) != 0 || !S_ISREG(sb_out.st_mode) ||
+       (sb_in.st_dev == sb_out.st_dev && sb_in.st_ino == sb_out.st_ino) ||
+       (in_start = lseek(fd_in, 0, SEEK_CUR)) < 0 ||
+       (out_base = lseek(fd_out, 0, SEEK_CUR)) != sb_out.st_size)
+    {
+        return -1;
+    }
+
+    /*
+     First pass: count the line ends to get the size of the output, unless
+     the caller has counted them already.
+     */
+    if(cnt == 0)
+    {
+        if(scan_mapped(fd_in, &counted) != 0 || io_error)
+        {
+            lseek(fd_in, in_start, SEEK_SET);
+            return -1;
+        }
+        lseek(fd_in, in_start, SEEK_SET);
+        cnt = &counted;
+    }
+
+    out_end = out_base + (off_t)eol_converted_size(output_format,
+                                                   sb_in.st_size - in_start,
+                                                   cnt);
+
+    if((ctx = eol_new(output_format)) == 0)
+    {
+        return -1;
+    }
+
+    /*
+     Give the output its final size in one step.  Without the space for it,
+     the write() path is used instead, and reports the error.
+     */
+    if(allocate_file(fd_out, out_base, out_end) < 0 ||
+       ftruncate(fd_out, out_end) != 0)
+    {
+        ftruncate(fd_out, out_base);
+        eol_free(ctx);
+        return -1;
+    }
+
+    /* Second pass: convert from the input mapping to the output mapping. */
+    in_off = in_start;
+    out_off = out_base;
+
+#ifdef EOL_THREADS
+    if(set_parallel(fd_in, in_start, sb_in.st_size,
+                    fd_out, out_base, out_end, output_format, nl) == 0)
+    {
+        in_off = sb_in.st_size;
+        out_off = out_end;
+    }
+#endif /* EOL_THREADS */
+    in_serial = in_off;
+
+    while(in_off < sb_in.st_size)
+    {
+        len = (sb_in.st_size - in_off > (off_t)EOL_MAP_BUDGET)
+                  ? EOL_MAP_BUDGET : (size_t)(sb_in.st_size - in_off);
+        out_len = (out_end - out_off > (off_t)(2 * len))
+                      ? 2 * len : (size_t)(out_end - out_off);
+
+        if(map_file(fd_in, in_off, len, PROT_READ, &map_in) != 0)
+        {
+            break;
+        }
+        if(map_file(fd_out, out_off, out_len, PROT_READ | PROT_WRITE,
+                    &map_out) != 0)
+        {
+            unmap_file(&map_in);
+            break;
+        }
+
+        madvise(map_in.base, map_in.base_len, MADV_SEQUENTIAL);
+        madvise(map_out.base, map_out.base_len, MADV_SEQUENTIAL);
+
+        out_off += (off_t)eol_feed_exact(ctx, map_in.data, map_in.len,
+                                         map_out.data);
+
+        unmap_file(&map_out);
+        unmap_file(&map_in);
+        in_off += (off_t)len;
+    }
+
+    if(in_off == in_start && in_off < sb_in.st_size)
+    {
+        /* Nothing converted: write the file instead. */
+        ftruncate(fd_out, out_base);
+        eol_free(ctx);
+        return -1;
+    }
+
+    /* The windows converted here, unless set_parallel() did them all. */
+    if(in_off > in_serial)
+    {
+        *nl += eol_line_ends(ctx);
+        kernel_used = eol_kernel_name(ctx);
+    }
+    eol_free(ctx);
+
+    if(in_off < sb_in.st_size || out_off != out_end)
+    {
+        report("Error: Cannot convert input through memory mappings.\n"
+               "       Reason: %s.\n",
+               in_off < sb_in.st_size ? strerror(errno)
+               : "The input changed size");
+        io_error = 1;
+    }
+
+    /* Leave the file offsets at the end, as reading and writing would. */
+    lseek(fd_in, in_off, SEEK_SET);
+    lseek(fd_out, out_off, SEEK_SET);
+
+    return 0;
+}
+
+#endif /* EOL_MMAP */
+
+/*
+ ------------------------------------------------------------------------------
+ read_block() - Read up to size bytes from a file descriptor.
+
+    Returns the number of bytes read, 0 at EOF or -1 on error.  Short reads
+    from pipes and terminals are returned as they are.
+ ------------------------------------------------------------------------------
+ */
+
+int read_block(int fd, unsigned char *buf, size_t size)
+{
+    int n;
+
+    do
+    {
+        n = (int)read(fd, buf, size);
+    } while(n < 0 && errno == EINTR);
+
+    if(n < 0)
+    {
+        report("Error: Cannot read input.\n"
+               "       Reason: %s.\n",
+               strerror(errno));
+        io_error = 1;
+    }
+
+    return n;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ write_block() - Write len bytes to a file descriptor.
+
+    Returns 0 when all bytes were written or -1 on error.
+ ------------------------------------------------------------------------------
+ */
+
+int write_block(int fd, const unsigned char *buf, size_t len)
+{
+    int n;
+
+    while(len > 0)
+    {
+        n = (int)write(fd, buf, len);
+
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+
+            report("Error: Cannot write output.\n"
+                   "       Reason: %s.\n",
+                   strerror(errno));
+            io_error = 1;
+            return -1;
+        }
+
+        buf += n;
+        len -= (size_t)n;
+    }
+
+    return 0;
 }
 
 /* ************************************************************************* */
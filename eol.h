@@ -0,0 +1,106 @@
+/* eol.h - Set or scan the end-of-line characters of text. */
+/* C language version. */
+/* ************************************************************************* */
+
+/*
+ ******************************************************************************
+ libeol
+
+    The line end conversion and counting of eol, as a library.  All state
+    of a conversion or a scan lives in a context, so any number of them can
+    run at once, on any threads.
+
+    Text is fed to a context in chunks of any size with eol_feed(), and
+    eol_finish() ends it.  A CR at the end of a chunk is carried into the
+    next one, so a CR+LF pair split between two chunks is still one line
+    end.
+
+        struct eol_ctx *ctx = eol_new(EOL_UNIX);
+
+        while((n = read(fd_in, in, sizeof(in))) > 0)
+        {
+            write(fd_out, out, eol_feed(ctx, in, n, out));
+        }
+        eol_finish(ctx);
+        eol_free(ctx);
+
+    The kernels, and the thresholds measured by eol_autotune(), are shared
+    by all contexts.  eol_select_kernels(), eol_load_tuning() and
+    eol_autotune() change them, so they must be called before any context
+    exists, and not while other threads use the library.  Otherwise the
+    fastest kernels this CPU supports are chosen once, by the first
+    function that needs them, on whichever thread calls it first.
+ ******************************************************************************
+ */
+
+#ifndef EOL_H
+#define EOL_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* What a context does: scan, or set one of the output formats. */
+enum EOL_FORMATS {EOL_SCAN, EOL_UNIX, EOL_MSDOS, EOL_MAC};
+
+/*
+ eol_feed() may store up to EOL_SLACK bytes past the end of the output it
+ returns, so out must have room for EOL_MAX_OUTPUT(len) bytes.
+ eol_feed_exact() stores nothing past it.
+ */
+#define EOL_SLACK 64
+#define EOL_MAX_OUTPUT(len) (2 * (len) + EOL_SLACK)
+
+/* Line ends counted by a scan. */
+struct eol_counts
+{
+    int prev_cr;            /* the text so far ends with a CR not counted yet */
+    unsigned long cnt_msdos;
+    unsigned long cnt_mac;
+    unsigned long cnt_unix;
+};
+
+struct eol_ctx;
+
+/* Contexts. */
+struct eol_ctx *eol_new(int format);
+void eol_free(struct eol_ctx *ctx);
+void eol_reset(struct eol_ctx *ctx);
+void eol_carry_cr(struct eol_ctx *ctx, int prev_cr);
+
+/* Feeding text. */
+size_t eol_feed(struct eol_ctx *ctx, const void *in, size_t len, void *out);
+size_t eol_feed_exact(struct eol_ctx *ctx, const void *in, size_t len,
+                      void *out);
+void eol_finish(struct eol_ctx *ctx);
+
+/* Results. */
+void eol_get_counts(const struct eol_ctx *ctx, struct eol_counts *cnt);
+unsigned long eol_line_ends(const struct eol_ctx *ctx);
+const char *eol_kernel_name(const struct eol_ctx *ctx);
+
+/* Whole texts. */
+long long eol_converted_size(int format, long long size,
+                             const struct eol_counts *cnt);
+int eol_conforming(int format, const struct eol_counts *cnt);
+void eol_substitute(void *buf, size_t len, int from, int to);
+size_t eol_find(const void *buf, size_t len);
+
+/* Kernels, shared by all contexts. */
+int eol_select_kernels(const char *name);
+const char *eol_selected_kernels(void);
+const char *eol_kernel_list(int i);
+const char *eol_tuning_path(void);
+int eol_load_tuning(const char *path);
+int eol_autotune(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* EOL_H */
+
+/* ************************************************************************* */
+/* end of eol.h */
@@ -0,0 +1,325 @@
+/* eol.hpp - Set or scan the end-of-line characters of text. */
+/* C++ language version. */
+/* ************************************************************************* */
+
+/*
+ ******************************************************************************
+ libeol for C++
+
+    C++ classes over libeol (eol.h).  They are header-only: a program that
+    uses them includes this file and links with libeol.a or libeol.so.
+
+    normalizing_streambuf reads from another streambuf and converts its
+    line ends as it goes, with the same rules and kernels as eol:
+
+        std::ifstream file("upload.txt", std::ios::binary);
+        eol::normalizing_streambuf buf(file.rdbuf(), EOL_UNIX);
+        std::istream in(&buf);
+
+        while(std::getline(in, line))
+        {
+            ...
+        }
+
+    The underlying streambuf should be opened in binary mode, so that no
+    line ends are converted before libeol sees them.
+
+    With C++20, lines is a view of the lines of a text in memory, such as a
+    mapped file.  Each line is a string_view into the text, without its
+    line end, and the kind of line end it had:
+
+        for(const eol::line &l : eol::lines(text))
+        {
+            if(l.end == eol::line_end::crlf)
+            ...
+        }
+ ******************************************************************************
+ */
+
+#ifndef EOL_HPP
+#define EOL_HPP
+
+#include <cstddef>
+#include <new>
+#include <stdexcept>
+#include <streambuf>
+#include <vector>
+
+#if __cplusplus >= 202002L
+#include <iterator>
+#include <ranges>
+#include <string_view>
+#endif
+
+#include "eol.h"
+
+namespace eol
+{
+
+/*
+ ------------------------------------------------------------------------------
+ normalizing_streambuf - Input streambuf that converts line ends.
+
+    Reads block bytes at a time from src, converts them with eol_feed() and
+    hands out the result.  A CR+LF pair split between two blocks is still
+    one line end.  src is not owned, and must outlive this streambuf.
+
+    Only reading is supported; format is EOL_UNIX, EOL_MSDOS or EOL_MAC.
+    Throws std::invalid_argument for any other format, and std::bad_alloc
+    if the context cannot be made.
+ ------------------------------------------------------------------------------
+ */
+
+class normalizing_streambuf : public std::streambuf
+{
+public:
+    static const std::size_t default_block = 256 * 1024;
+
+    explicit normalizing_streambuf(std::streambuf *src, int format = EOL_UNIX,
+                                   std::size_t block = default_block)
+        : src_(src), ctx_(0), in_(block ? block : 1),
+          out_(EOL_MAX_OUTPUT(in_.size())), eof_(false)
+    {
+        if(format != EOL_UNIX && format != EOL_MSDOS && format != EOL_MAC)
+        {
+            throw std::invalid_argument("eol::normalizing_streambuf: "
+                                        "format is not an output format");
+        }
+
+        if((ctx_ = eol_new(format)) == 0)
+        {
+            throw std::bad_alloc();
+        }
+
+        setg(&out_[0], &out_[0], &out_[0]);
+    }
+
+    ~normalizing_streambuf()
+    {
+        eol_free(ctx_);
+    }
+
+    /* Line ends converted so far. */
+    unsigned long line_ends() const
+    {
+        return eol_line_ends(ctx_);
+    }
+
+    /*
+     Name of the kernels used.  Before the first block, it names the ones
+     the context starts with, which a block may change.
+     */
+    const char *kernel_name() const
+    {
+        return eol_kernel_name(ctx_);
+    }
+
+protected:
+    int_type underflow()
+    {
+        std::streamsize n;
+        std::size_t len;
+
+        if(gptr() < egptr())
+        {
+            return traits_type::to_int_type(*gptr());
+        }
+
+        /* A block can convert to nothing, e.g. the LF of a split CR+LF. */
+        while(!eof_)
+        {
+            n = src_->sgetn(&in_[0], (std::streamsize)in_.size());
+            if(n <= 0)
+            {
+                eof_ = true;
+                eol_finish(ctx_);
+                break;
+            }
+
+            len = eol_feed(ctx_, &in_[0], (std::size_t)n, &out_[0]);
+            if(len > 0)
+            {
+                setg(&out_[0], &out_[0], &out_[0] + len);
+                return traits_type::to_int_type(*gptr());
+            }
+        }
+
+        return traits_type::eof();
+    }
+
+private:
+    normalizing_streambuf(const normalizing_streambuf &);
+    normalizing_streambuf &operator=(const normalizing_streambuf &);
+
+    std::streambuf *src_;
+    eol_ctx *ctx_;
+    std::vector<char> in_;
+    std::vector<char> out_;
+    bool eof_;
+};
+
+#if __cplusplus >= 202002L
+
+/*
+ Line end kinds.  Each has the number of the output format that writes it,
+ and none, for a last line without a line end, is EOL_SCAN.
+ */
+enum class line_end
+{
+    none = EOL_SCAN,
+    lf = EOL_UNIX,
+    crlf = EOL_MSDOS,
+    cr = EOL_MAC
+};
+
+struct line
+{
+    std::string_view text;  /* the line, without its line end */
+    line_end end;
+};
+
+/*
+ ------------------------------------------------------------------------------
+ lines - View of the lines of a text.
+
+    Line ends are found with eol_find(), a vector at a time, and are counted
+    as by a scan: CR+LF is one MS-DOS line end, and a CR or LF alone is a
+    Macintosh or UNIX one.  A text that ends with a line end has no empty
+    line after it, and an empty text has no lines.  Nothing is copied, so
+    the text must outlive the view and the lines.
+ ------------------------------------------------------------------------------
+ */
+
+class lines : public std::ranges::view_interface<lines>
+{
+public:
+    class iterator
+    {
+    public:
+        using value_type = line;
+        using difference_type = std::ptrdiff_t;
+        using iterator_concept = std::forward_iterator_tag;
+
+        iterator() = default;
+
+        iterator(const char *p, const char *end)
+            : end_(end), next_(p), done_(false)
+        {
+            advance();
+        }
+
+        const line &operator*() const
+        {
+            return line_;
+        }
+
+        const line *operator->() const
+        {
+            return &line_;
+        }
+
+        iterator &operator++()
+        {
+            advance();
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator it = *this;
+            advance();
+            return it;
+        }
+
+        bool operator==(const iterator &it) const
+        {
+            return done_ == it.done_ && next_ == it.next_;
+        }
+
+        bool operator==(std::default_sentinel_t) const
+        {
+            return done_;
+        }
+
+    private:
+        void advance()
+        {
+            const char *p = next_;
+            std::size_t n;
+
+            if(p == end_)
+            {
+                done_ = true;
+                return;
+            }
+
+            n = eol_find(p, (std::size_t)(end_ - p));
+            line_.text = std::string_view(p, n);
+            p += n;
+
+            if(p == end_)
+            {
+                line_.end = line_end::none;
+            }
+            else if(*p++ == '\n')
+            {
+                line_.end = line_end::lf;
+            }
+            else if(p < end_ && *p == '\n')
+            {
+                line_.end = line_end::crlf;
+                p++;
+            }
+            else
+            {
+                line_.end = line_end::cr;
+            }
+
+            next_ = p;
+        }
+
+        const char *end_ = nullptr;
+        const char *next_ = nullptr;   /* start of the line after line_ */
+        line line_ = {};
+        bool done_ = true;
+    };
+
+    lines() = default;
+
+    explicit lines(std::string_view text) : text_(text)
+    {
+    }
+
+    lines(const void *text, std::size_t len)
+        : text_(static_cast<const char *>(text), len)
+    {
+    }
+
+    iterator begin() const
+    {
+        return iterator(text_.data(), text_.data() + text_.size());
+    }
+
+    std::default_sentinel_t end() const
+    {
+        return std::default_sentinel;
+    }
+
+private:
+    std::string_view text_;
+};
+
+#endif /* __cplusplus >= 202002L */
+
+} /* namespace eol */
+
+#if __cplusplus >= 202002L
+/* The lines refer to the text, not to the view, so they outlive it. */
+template<>
+inline constexpr bool std::ranges::enable_borrowed_range<eol::lines> = true;
+#endif
+
+#endif /* EOL_HPP */
+
+/* ************************************************************************* */
+/* end of eol.hpp */
@@ -0,0 +1,2109 @@
+/* libeol.c - Set or scan the end-of-line characters of text. */
+/* C language version. */
+/* ************************************************************************* */
+
+/*
+ ******************************************************************************
+ Description:
+
+    The line end conversion and counting of eol, with all the state of a
+    conversion or a scan in a context.  See eol.h.
+
+ Setting the end-of-line characters:
+
+    The existing end-of-line characters of the text are ignored and the
+    specified end-of-line characters are written to the output.
+
+ Scanning for end-of-line characters:
+
+    The line ends of each supported type are counted.
+ ******************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifndef MS_WIN32_COMPILER
+#include <pthread.h>
+#define EOL_THREADS
+#endif /* MS_WIN32_COMPILER */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define EOL_X86_KERNELS
+#include <immintrin.h>
+#endif /* __GNUC__ && x86 */
+
+#include "eol.h"
+
+/* Conversion state carried from one block to the next by a set kernel. */
+struct eol_set_state
+{
+    int format;             /* output format */
+    int prev_cr;            /* last byte of the previous block was a CR */
+    unsigned long nl;       /* line ends processed */
+};
+
+/*
+ Kernels.
+ A scan kernel counts the line ends in one block, and a set kernel converts
+ the line ends in one block.  Both carry a CR at the end of the block to the
+ next call.  All kernels give the same results; they differ only in the
+ instructions they use.
+
+ A set kernel may store up to EOL_SLACK bytes past the end of the output it
+ returns, because it stores whole vectors.  Such bytes are overwritten by
+ the next call.  convert_exact() is for output that must not be written
+ past its end.
+ */
+#define EOL_SET_TAIL (4 * EOL_SLACK)
+
+typedef void (*scan_kernel_fn)(const unsigned char *in, size_t len,
+                               struct eol_counts *st);
+typedef size_t (*set_kernel_fn)(const unsigned char *in, size_t len,
+                                unsigned char *out, struct eol_set_state *st);
+
+/*
+ Kernels specialized per output format.
+ The scalar, run and SSE2 set kernels are written once, with the output
+ format as a parameter, and inlined by SET_KERNELS() into one function per
+ format.  The line end is a constant in each of them, so the loops have no
+ format left to test, and the compiler unrolls and vectorizes each on its
+ own.  A kernel set holds one set kernel per format, and a context picks
+ the one for its format once, with the rest of its kernels.
+ */
+#ifdef __GNUC__
+#define EOL_INLINE inline __attribute__((always_inline))
+#else
+#define EOL_INLINE __inline
+#endif /* __GNUC__ */
+
+#define SET_KERNELS(attr, name, generic)                                      \
+attr static size_t name##_unix(const unsigned char *in, size_t len,          \
+                               unsigned char *out, struct eol_set_state *st)  \
+{                                                                             \
+    return generic(in, len, out, st, EOL_UNIX);                               \
+}                                                                             \
+attr static size_t name##_msdos(const unsigned char *in, size_t len,         \
+                                unsigned char *out, struct eol_set_state *st) \
+{                                                                             \
+    return generic(in, len, out, st, EOL_MSDOS);                              \
+}                                                                             \
+attr static size_t name##_mac(const unsigned char *in, size_t len,           \
+                              unsigned char *out, struct eol_set_state *st)   \
+{                                                                             \
+    return generic(in, len, out, st, EOL_MAC);                                \
+}
+
+/* The set kernels of a kernel set, indexed by output format. */
+#define SET_KERNEL_SET(name) {0, name##_unix, name##_msdos, name##_mac}
+
+/*
+ A substitution kernel replaces every byte from in buf by the byte to, and
+ stores nothing in the parts of buf that have no byte from, so a mapped file
+ only gets dirty pages where bytes changed.
+ */
+typedef void (*subst_kernel_fn)(unsigned char *buf, size_t len,
+                                unsigned char from, unsigned char to);
+
+/* A find kernel returns the first CR or LF from p up to end, or end. */
+typedef const unsigned char *(*find_kernel_fn)(const unsigned char *p,
+                                               const unsigned char *end);
+
+static void scan_block_scalar(const unsigned char *in, size_t len,
+                              struct eol_counts *st);
+static size_t set_block_scalar(const unsigned char *in, size_t len,
+                               unsigned char *out, struct eol_set_state *st);
+static size_t set_block_scalar_unix(const unsigned char *in, size_t len,
+                                    unsigned char *out,
+                                    struct eol_set_state *st);
+static size_t set_block_scalar_msdos(const unsigned char *in, size_t len,
+                                     unsigned char *out,
+                                     struct eol_set_state *st);
+static size_t set_block_scalar_mac(const unsigned char *in, size_t len,
+                                   unsigned char *out,
+                                   struct eol_set_state *st);
+static size_t convert_exact(set_kernel_fn set, const unsigned char *in,
+                            size_t len, unsigned char *out,
+                            struct eol_set_state *st);
+static void scan_block_runs(const unsigned char *in, size_t len,
+                            struct eol_counts *st);
+static size_t set_block_runs_unix(const unsigned char *in, size_t len,
+                                  unsigned char *out,
+                                  struct eol_set_state *st);
+static size_t set_block_runs_msdos(const unsigned char *in, size_t len,
+                                   unsigned char *out,
+                                   struct eol_set_state *st);
+static size_t set_block_runs_mac(const unsigned char *in, size_t len,
+                                 unsigned char *out, struct eol_set_state *st);
+static const unsigned char *find_eol(const unsigned char *p,
+                                     const unsigned char *end);
+static void scan_block_swar(const unsigned char *in, size_t len,
+                            struct eol_counts *st);
+static void subst_block_runs(unsigned char *buf, size_t len,
+                             unsigned char from, unsigned char to);
+#ifdef EOL_X86_KERNELS
+static void scan_block_sse2(const unsigned char *in, size_t len,
+                            struct eol_counts *st);
+static void scan_block_avx2(const unsigned char *in, size_t len,
+                            struct eol_counts *st);
+static void scan_block_avx512(const unsigned char *in, size_t len,
+                              struct eol_counts *st);
+static size_t set_block_sse2_unix(const unsigned char *in, size_t len,
+                                  unsigned char *out,
+                                  struct eol_set_state *st);
+static size_t set_block_sse2_msdos(const unsigned char *in, size_t len,
+                                   unsigned char *out,
+                                   struct eol_set_state *st);
+static size_t set_block_sse2_mac(const unsigned char *in, size_t len,
+                                 unsigned char *out, struct eol_set_state *st);
+static size_t compact_block_avx2(const unsigned char *in, size_t len,
+                                 unsigned char *out, struct eol_set_state *st);
+static size_t compact_block_avx512(const unsigned char *in, size_t len,
+                                   unsigned char *out,
+                                   struct eol_set_state *st);
+static size_t expand_block_avx2(const unsigned char *in, size_t len,
+                                unsigned char *out, struct eol_set_state *st);
+static void subst_block_sse2(unsigned char *buf, size_t len,
+                             unsigned char from, unsigned char to);
+static void subst_block_avx2(unsigned char *buf, size_t len,
+                             unsigned char from, unsigned char to);
+static void subst_block_avx512(unsigned char *buf, size_t len,
+                               unsigned char from, unsigned char to);
+static const unsigned char *find_eol_sse2(const unsigned char *p,
+                                          const unsigned char *end);
+static const unsigned char *find_eol_avx2(const unsigned char *p,
+                                          const unsigned char *end);
+static const unsigned char *find_eol_avx512(const unsigned char *p,
+                                            const unsigned char *end);
+
+/* Tables and CPU features used by the SIMD kernels. */
+static unsigned char compact_shuffle[256][8];
+static unsigned char expand_shuffle[256][16];
+static unsigned char expand_eol[256][16];
+static int cpu_has_vbmi2 = 0;
+
+static void init_kernel_tables(void);
+#endif /* EOL_X86_KERNELS */
+
+/*
+ Kernel sets, from the most portable to the fastest.
+ Unless a kernel set is named to eol_select_kernels(), each context scans
+ or sets with the run kernels when the mean line length of the first text
+ fed to it is at least scan_sparse or set_sparse bytes, and with the
+ kernels of the set otherwise.  Zero means the run kernels are never used.
+ The defaults can be replaced by values measured with eol_autotune().
+ */
+struct eol_kernel
+{
+    char *name;
+    char *cpu_feature;      /* required CPU feature, 0 if none */
+    scan_kernel_fn scan;
+    set_kernel_fn set[EOL_MAC + 1];     /* by output format */
+    subst_kernel_fn subst;
+    find_kernel_fn find;
+    unsigned long scan_sparse;
+    unsigned long set_sparse;
+};
+
+static struct eol_kernel eol_kernels[] =
+{
+    {"scalar", 0,        scan_block_scalar,
+                         SET_KERNEL_SET(set_block_scalar),
+                         subst_block_runs,   find_eol,        0,  0},
+    {"runs",   0,        scan_block_runs,
+                         SET_KERNEL_SET(set_block_runs),
+                         subst_block_runs,   find_eol,        0,  0},
+    {"swar",   0,        scan_block_swar,
+                         SET_KERNEL_SET(set_block_scalar),
+                         subst_block_runs,   find_eol,       64, 32},
+#ifdef EOL_X86_KERNELS
+    {"sse2",   "sse2",   scan_block_sse2,
+                         SET_KERNEL_SET(set_block_sse2),
+                         subst_block_sse2,   find_eol_sse2,   0,  0},
+    {"avx2",   "avx2",   scan_block_avx2,
+                         {0, compact_block_avx2, expand_block_avx2,
+                          compact_block_avx2},
+                         subst_block_avx2,   find_eol_avx2,   0,  0},
+    {"avx512", "avx512", scan_block_avx512,
+                         {0, compact_block_avx512, expand_block_avx2,
+                          compact_block_avx512},
+                         subst_block_avx512, find_eol_avx512, 0,  0},
+#endif /* EOL_X86_KERNELS */
+};
+
+#define EOL_KERNEL_COUNT (sizeof(eol_kernels) / sizeof(eol_kernels[0]))
+
+/* The run kernels, used for sparse line ends. */
+#define EOL_RUN_KERNELS (&eol_kernels[1])
+
+/* The kernels of all contexts, chosen by eol_select_kernels(). */
+static struct eol_kernel *kernel = &eol_kernels[0];
+static int kernel_selected = 0;
+static int kernel_pinned = 0;
+
+static int kernel_supported(struct eol_kernel *k);
+
+/*
+ The SIMD tables are built, and the default kernels chosen if none were,
+ once per process, by the first thread that needs them.
+ */
+#ifdef EOL_THREADS
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+static pthread_once_t kernels_once = PTHREAD_ONCE_INIT;
+#define EOL_ONCE(once, fn) pthread_once(&(once), fn)
+#else
+static int tables_once = 0;
+static int kernels_once = 0;
+#define EOL_ONCE(once, fn) \
+    do { if(!(once)) { (once) = 1; fn(); } } while(0)
+#endif /* EOL_THREADS */
+
+static void need_kernels(void);
+
+/*
+ Density-adaptive kernel selection.
+ The mean line length is measured on up to EOL_SAMPLE_SIZE bytes of the
+ first text fed to each context.
+ */
+#define EOL_SAMPLE_SIZE (64 * 1024)
+
+static unsigned long mean_line_length(const unsigned char *buf, size_t len);
+static scan_kernel_fn choose_scan_kernel(const unsigned char *buf, size_t len,
+                                         const char **name);
+static set_kernel_fn choose_set_kernel(const unsigned char *buf, size_t len,
+                                       int format, const char **name);
+
+/*
+ Contexts.
+ A context chooses its kernel from the first text fed to it, and keeps the
+ counts and the CR carried between calls.
+ */
+struct eol_ctx
+{
+    int format;             /* EOL_SCAN or an output format */
+    scan_kernel_fn scan;    /* kernel chosen, 0 until text is fed */
+    set_kernel_fn set;
+    const char *kernel_name;
+    struct eol_counts cnt;
+    struct eol_set_state st;
+};
+
+/*
+ ------------------------------------------------------------------------------
+ eol_new() - Make a context that scans, or sets an output format.
+
+    format is EOL_SCAN, EOL_UNIX, EOL_MSDOS or EOL_MAC.  Returns the
+    context, or 0 if format is unknown or there is no memory for it.
+ ------------------------------------------------------------------------------
+ */
+
+struct eol_ctx *eol_new(int format)
+{
+    struct eol_ctx *ctx;
+
+    if(format < EOL_SCAN || format > EOL_MAC)
+    {
+        return 0;
+    }
+
+    need_kernels();
+
+    ctx = malloc(sizeof(*ctx));
+    if(ctx == 0)
+    {
+        return 0;
+    }
+
+    ctx->format = format;
+    eol_reset(ctx);
+
+    return ctx;
+}
+
+void eol_free(struct eol_ctx *ctx)
+{
+    free(ctx);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_reset() - Start a context on new text.
+
+    The counts are cleared, and the kernel is chosen again from the next
+    text fed.
+ ------------------------------------------------------------------------------
+ */
+
+void eol_reset(struct eol_ctx *ctx)
+{
+    ctx->scan = 0;
+    ctx->set = 0;
+    ctx->kernel_name = kernel->name;
+    memset(&ctx->cnt, 0, sizeof(ctx->cnt));
+    ctx->st.format = ctx->format;
+    ctx->st.prev_cr = 0;
+    ctx->st.nl = 0L;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_carry_cr() - Continue as if the text before ended with a CR, or not.
+
+    For text that is converted in pieces out of order: an LF at the start
+    of the next text fed is the second half of a CR+LF pair when prev_cr is
+    set.  The CR itself is not counted by the context.
+ ------------------------------------------------------------------------------
+ */
+
+void eol_carry_cr(struct eol_ctx *ctx, int prev_cr)
+{
+    ctx->cnt.prev_cr = (prev_cr != 0);
+    ctx->st.prev_cr = (prev_cr != 0);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_feed() - Scan or convert the next len bytes of text.
+
+    Converts in to out, and returns the number of bytes written to out,
+    which is at most 2 * len.  out must have room for EOL_MAX_OUTPUT(len)
+    bytes, because the kernels may store up to EOL_SLACK bytes past the
+    output.  A scan only counts, writes nothing to out and returns 0; out
+    may be 0.  A CR at the end of in is carried to the next call.
+ ------------------------------------------------------------------------------
+ */
+
+size_t eol_feed(struct eol_ctx *ctx, const void *in, size_t len, void *out)
+{
+    if(len == 0)
+    {
+        return 0;
+    }
+
+    if(ctx->format == EOL_SCAN)
+    {
+        if(ctx->scan == 0)
+        {
+            ctx->scan = choose_scan_kernel(in, len, &ctx->kernel_name);
+        }
+
+        ctx->scan(in, len, &ctx->cnt);
+        return 0;
+    }
+
+    if(ctx->set == 0)
+    {
+        ctx->set = choose_set_kernel(in, len, ctx->format,
+                                     &ctx->kernel_name);
+    }
+
+    return ctx->set(in, len, out, &ctx->st);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_feed_exact() - Convert the next len bytes of text, without writing past
+                    the output.
+
+    Like eol_feed(), but out needs room only for the bytes written to it,
+    so it can be an exactly sized mapping of an output file.
+ ------------------------------------------------------------------------------
+ */
+
+size_t eol_feed_exact(struct eol_ctx *ctx, const void *in, size_t len,
+                      void *out)
+{
+    if(len == 0 || ctx->format == EOL_SCAN)
+    {
+        return eol_feed(ctx, in, len, out);
+    }
+
+    if(ctx->set == 0)
+    {
+        ctx->set = choose_set_kernel(in, len, ctx->format,
+                                     &ctx->kernel_name);
+    }
+
+    return convert_exact(ctx->set, in, len, out, &ctx->st);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_finish() - End the text.
+
+    A CR at the end of the text has no LF after it: a scan counts it as
+    Macintosh.  A conversion has written every line end already, so there
+    is no more output.
+ ------------------------------------------------------------------------------
+ */
+
+void eol_finish(struct eol_ctx *ctx)
+{
+    if(ctx->cnt.prev_cr)
+    {
+        ctx->cnt.cnt_mac++;
+        ctx->cnt.prev_cr = 0;
+    }
+
+    ctx->st.prev_cr = 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_get_counts(), eol_line_ends(), eol_kernel_name() - Results of a context.
+
+    A scan counts the line ends of each type, and prev_cr tells whether a
+    CR at the end of the text so far is still to be counted.  A conversion
+    counts only the line ends it has converted, returned by
+    eol_line_ends().  eol_kernel_name() names the kernels the context
+    chose; the name stays valid after the context is freed.
+ ------------------------------------------------------------------------------
+ */
+
+void eol_get_counts(const struct eol_ctx *ctx, struct eol_counts *cnt)
+{
+    *cnt = ctx->cnt;
+}
+
+unsigned long eol_line_ends(const struct eol_ctx *ctx)
+{
+    if(ctx->format == EOL_SCAN)
+    {
+        return ctx->cnt.cnt_msdos + ctx->cnt.cnt_mac + ctx->cnt.cnt_unix;
+    }
+
+    return ctx->st.nl;
+}
+
+const char *eol_kernel_name(const struct eol_ctx *ctx)
+{
+    return ctx->kernel_name;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_substitute() - Replace every byte from in buf by the byte to.
+
+    Converts between UNIX and Macintosh line ends in text without CR+LF
+    pairs.  Stores only where a byte changes, so a shared mapping of a file
+    gets dirty pages only where the line ends are.
+ ------------------------------------------------------------------------------
+ */
+
+void eol_substitute(void *buf, size_t len, int from, int to)
+{
+    need_kernels();
+
+    kernel->subst(buf, len, (unsigned char)from, (unsigned char)to);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_find() - Find the first line end in buf.
+
+    Returns the offset of the first CR or LF in the len bytes of buf, or len
+    if there is none.  Searches a vector at a time with the selected kernels.
+ ------------------------------------------------------------------------------
+ */
+
+size_t eol_find(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    need_kernels();
+
+    return (size_t)(kernel->find(p, p + len) - p);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ put_eol() - Write the line end of an output format.
+
+    format is a constant in the specialized kernels, so this is one or two
+    stores of constant bytes.  Returns the output after the line end.
+ ------------------------------------------------------------------------------
+ */
+
+static EOL_INLINE unsigned char *put_eol(unsigned char *o, const int format)
+{
+    if(format == EOL_MSDOS)
+    {
+        o[0] = '\r';
+        o[1] = '\n';
+        return o + 2;
+    }
+
+    o[0] = (format == EOL_MAC) ? '\r' : '\n';
+    return o + 1;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ set_block_scalar() - Set EOL characters in one block, one byte at a time.
+
+    Converts len bytes from in to out and returns the number of bytes written
+    to out, which is at most 2 * len.  A CR is converted as soon as it is
+    seen.  If it is the last byte of the block, st->prev_cr tells the next
+    call to eat a single LF at the start of the next block.
+
+    set_scalar() is the loop, and set_block_scalar_unix(), _msdos() and
+    _mac() are its specializations.  set_block_scalar() calls the one for
+    st->format, for the kernels that convert their last bytes with it.
+ ------------------------------------------------------------------------------
+ */
+
+static EOL_INLINE size_t set_scalar(const unsigned char *in, size_t len,
+                                    unsigned char *out,
+                                    struct eol_set_state *st, const int format)
+{
+    const unsigned char *end = in + len;
+    unsigned char *o = out;
+    int ch;
+    int prev_cr = st->prev_cr;
+    unsigned long nl = st->nl;
+
+    while(in < end)
+    {
+        ch = *in++;
+
+        if(ch == '\r')
+        {
+            /* CR.  Write the line end, and eat a LF that follows it. */
+            nl++;
+            o = put_eol(o, format);
+            prev_cr = 1;
+        }
+        else if(ch == '\n')
+        {
+            /* LF.  Eat it if it follows a CR, else write the line end. */
+            if(!prev_cr)
+            {
+                nl++;
+                o = put_eol(o, format);
+            }
+            prev_cr = 0;
+        }
+        else
+        {
+            /* Regular character.  Just write it. */
+            *o++ = (unsigned char)ch;
+            prev_cr = 0;
+        }
+    }
+
+    st->prev_cr = prev_cr;
+    st->nl = nl;
+
+    return (size_t)(o - out);
+}
+
+SET_KERNELS(, set_block_scalar, set_scalar)
+
+static size_t set_block_scalar(const unsigned char *in, size_t len,
+                               unsigned char *out, struct eol_set_state *st)
+{
+    switch(st->format)
+    {
+        case EOL_MSDOS:
+            return set_block_scalar_msdos(in, len, out, st);
+        case EOL_MAC:
+            return set_block_scalar_mac(in, len, out, st);
+        case EOL_UNIX:
+        default:
+            return set_block_scalar_unix(in, len, out, st);
+    }
+}
+
+/*
+ ------------------------------------------------------------------------------
+ convert_exact() - Set EOL characters without writing past the output.
+
+    Like a set kernel, but stores nothing past the end of the output it
+    returns, so out can be an exactly sized mapping.  The last EOL_SET_TAIL
+    bytes of the input are converted into a small buffer and copied.  The
+    output of those bytes is at least EOL_SET_TAIL / 2 bytes, more than the
+    EOL_SLACK bytes the kernel may store past the output of the rest.
+ ------------------------------------------------------------------------------
+ */
+
+static size_t convert_exact(set_kernel_fn set, const unsigned char *in,
+                            size_t len, unsigned char *out,
+                            struct eol_set_state *st)
+{
+    unsigned char tail[2 * EOL_SET_TAIL + EOL_SLACK];
+    size_t n = 0;
+    size_t m;
+
+    if(len > EOL_SET_TAIL)
+    {
+        n = set(in, len - EOL_SET_TAIL, out, st);
+        in += len - EOL_SET_TAIL;
+        len = EOL_SET_TAIL;
+    }
+
+    m = set(in, len, tail, st);
+    memcpy(out + n, tail, m);
+
+    return n + m;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_converted_size() - Size of a text after setting its EOL characters.
+
+    cnt holds the line ends of the text, with a CR at its end counted as
+    Macintosh, as eol_finish() counts it.  Setting MS-DOS adds an LF to
+    each lone CR and a CR to each lone LF.  Setting UNIX or Macintosh drops
+    the LF of each CR+LF pair.
+ ------------------------------------------------------------------------------
+ */
+
+long long eol_converted_size(int format, long long size,
+                             const struct eol_counts *cnt)
+{
+    if(format == EOL_MSDOS)
+    {
+        return size + (long long)cnt->cnt_mac + (long long)cnt->cnt_unix;
+    }
+
+    return size - (long long)cnt->cnt_msdos;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_conforming() - Check if setting a format would change any line end.
+ ------------------------------------------------------------------------------
+ */
+
+int eol_conforming(int format, const struct eol_counts *cnt)
+{
+    switch(format)
+    {
+        case EOL_MSDOS:
+            return cnt->cnt_mac == 0 && cnt->cnt_unix == 0;
+        case EOL_MAC:
+            return cnt->cnt_msdos == 0 && cnt->cnt_unix == 0;
+        case EOL_UNIX:
+            return cnt->cnt_msdos == 0 && cnt->cnt_mac == 0;
+        default:
+            return 0;
+    }
+}
+
+/*
+ ------------------------------------------------------------------------------
+ scan_block_scalar() - Scan one block for EOL characters, one byte at a time.
+
+    A CR is counted when the byte after it is seen.  If it is the last byte
+    of the block, st->prev_cr carries it to the next call, or to the caller
+    at EOF.
+ ------------------------------------------------------------------------------
+ */
+
+static void scan_block_scalar(const unsigned char *in, size_t len,
+                              struct eol_counts *st)
+{
+    const unsigned char *end = in + len;
+    int ch;
+
+    while(in < end)
+    {
+        ch = *in++;
+
+        if(st->prev_cr)
+        {
+            st->prev_cr = 0;
+
+            if(ch == '\n')
+            {
+                /* LF after CR: Count it as MS-DOS. */
+                st->cnt_msdos++;
+                continue;
+            }
+
+            /* No LF after CR: Count it as Macintosh. */
+            st->cnt_mac++;
+        }
+
+        if(ch == '\r')
+        {
+            /* CR.  Could be CR alone, or CR followed by LF. */
+            st->prev_cr = 1;
+        }
+        else if(ch == '\n')
+        {
+            /* LF.  Count it as UNIX. */
+            st->cnt_unix++;
+        }
+    }
+}
+
+/*
+ ------------------------------------------------------------------------------
+ find_eol() - Find the first CR or LF in p up to end.
+
+    Returns a pointer to the CR or LF, or end if there is none.  The bytes
+    are checked 8 at a time: XOR with a word of CRs (or LFs) turns each
+    matching byte into a zero byte, and
+
+        (x - 0x0101...01) & ~x & 0x8080...80
+
+    is non-zero when the word x has a zero byte.  Only a word with a match
+    is looked at one byte at a time, so this works on any target without
+    depending on the byte order.
+ ------------------------------------------------------------------------------
+ */
+
+#define EOL_WORD_ONES  0x0101010101010101ULL
+#define EOL_WORD_HIGHS 0x8080808080808080ULL
+#define EOL_WORD_CR    (EOL_WORD_ONES * '\r')
+#define EOL_WORD_LF    (EOL_WORD_ONES * '\n')
+
+#define EOL_HAS_ZERO_BYTE(x) (((x) - EOL_WORD_ONES) & ~(x) & EOL_WORD_HIGHS)
+
+static const unsigned char *find_eol(const unsigned char *p,
+                                     const unsigned char *end)
+{
+    uint64_t w;
+
+    while(end - p >= 8)
+    {
+        memcpy(&w, p, 8);
+
+        if(EOL_HAS_ZERO_BYTE(w ^ EOL_WORD_CR) |
+           EOL_HAS_ZERO_BYTE(w ^ EOL_WORD_LF))
+        {
+            break;
+        }
+
+        p += 8;
+    }
+
+    while(p < end && *p != '\r' && *p != '\n')
+    {
+        p++;
+    }
+
+    return p;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ Run kernels.
+
+    Text with long lines is mostly runs of bytes without line ends.  These
+    kernels use find_eol() to skip to the next CR or LF, copy the whole run
+    in front of it with memcpy() and only then handle the line end.  They do
+    not use SIMD instructions and work on every target.
+ ------------------------------------------------------------------------------
+ */
+
+static void scan_block_runs(const unsigned char *in, size_t len,
+                            struct eol_counts *st)
+{
+    const unsigned char *end = in + len;
+
+    while(in < end)
+    {
+        if(st->prev_cr)
+        {
+            st->prev_cr = 0;
+
+            if(*in == '\n')
+            {
+                /* LF after CR: Count it as MS-DOS. */
+                st->cnt_msdos++;
+                in++;
+                continue;
+            }
+
+            /* No LF after CR: Count it as Macintosh. */
+            st->cnt_mac++;
+        }
+
+        in = find_eol(in, end);
+        if(in == end)
+        {
+            break;
+        }
+
+        if(*in++ == '\r')
+        {
+            st->prev_cr = 1;
+        }
+        else
+        {
+            st->cnt_unix++;
+        }
+    }
+}
+
+static EOL_INLINE size_t set_runs(const unsigned char *in, size_t len,
+                                  unsigned char *out,
+                                  struct eol_set_state *st, const int format)
+{
+    const unsigned char *end = in + len;
+    const unsigned char *run;
+    unsigned char *o = out;
+
+    if(len == 0)
+    {
+        return 0;
+    }
+
+    /* Eat the LF of a CR+LF pair split between blocks. */
+    if(st->prev_cr && *in == '\n')
+    {
+        in++;
+    }
+    st->prev_cr = 0;
+
+    while(in < end)
+    {
+        /* Copy the run of regular characters. */
+        run = in;
+        in = find_eol(in, end);
+        memcpy(o, run, (size_t)(in - run));
+        o += in - run;
+
+        if(in == end)
+        {
+            break;
+        }
+
+        /* Write the line end, and eat the LF of a CR+LF pair. */
+        st->nl++;
+        o = put_eol(o, format);
+
+        if(*in++ == '\r')
+        {
+            if(in == end)
+            {
+                st->prev_cr = 1;
+            }
+            else if(*in == '\n')
+            {
+                in++;
+            }
+        }
+    }
+
+    return (size_t)(o - out);
+}
+
+SET_KERNELS(, set_block_runs, set_runs)
+
+/*
+ ------------------------------------------------------------------------------
+ scan_block_swar() - Scan one block for EOL characters, 8 bytes at a time.
+
+    This is the SIMD scan kernel done with 64-bit words, for targets without
+    vector instructions.  XOR with a word of CRs (or LFs) turns each matching
+    byte into a zero byte, and
+
+        ~(((x & 0x7f7f...7f) + 0x7f7f...7f) | x) & 0x8080...80
+
+    sets the high bit of exactly the zero bytes of x.  A CR+LF pair is an LF
+    whose high bit is set in the CR mask moved up one byte, with the last CR
+    of the previous word moved in.  The high bits are counted by moving them
+    to the low bits and summing the bytes with a multiply.
+ ------------------------------------------------------------------------------
+ */
+
+#define EOL_WORD_LOWS 0x7f7f7f7f7f7f7f7fULL
+
+#define EOL_ZERO_BYTES(x) \
+    (~((((x) & EOL_WORD_LOWS) + EOL_WORD_LOWS) | (x)) & EOL_WORD_HIGHS)
+
+#define EOL_COUNT_HIGHS(m) ((unsigned long)((((m) >> 7) * EOL_WORD_ONES) >> 56))
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define EOL_NEXT_BYTE(m)  ((m) >> 8)
+#define EOL_LAST_BYTE(m)  (((m) & 0x80) << 56)
+#else
+#define EOL_NEXT_BYTE(m)  ((m) << 8)
+#define EOL_LAST_BYTE(m)  ((m) >> 56)
+#endif /* __BYTE_ORDER__ */
+
+static void scan_block_swar(const unsigned char *in, size_t len,
+                            struct eol_counts *st)
+{
+    const unsigned char *end = in + (len & ~(size_t)7);
+    uint64_t w, cr, lf, pairs;
+    uint64_t carry = st->prev_cr ? EOL_LAST_BYTE(EOL_WORD_HIGHS) : 0;
+    unsigned long n_pairs = 0, n_lf = 0, n_cr = 0;
+
+    for(; in < end; in += 8)
+    {
+        memcpy(&w, in, 8);
+
+        cr = EOL_ZERO_BYTES(w ^ EOL_WORD_CR);
+        lf = EOL_ZERO_BYTES(w ^ EOL_WORD_LF);
+
+        if((cr | lf) == 0)
+        {
+            carry = 0;
+            continue;
+        }
+
+        pairs = lf & (EOL_NEXT_BYTE(cr) | carry);
+        carry = EOL_LAST_BYTE(cr);
+
+        n_pairs += EOL_COUNT_HIGHS(pairs);
+        n_lf += EOL_COUNT_HIGHS(lf);
+        n_cr += EOL_COUNT_HIGHS(cr);
+    }
+
+    st->cnt_msdos += n_pairs;
+    st->cnt_unix += n_lf - n_pairs;
+    st->cnt_mac += n_cr + (unsigned long)st->prev_cr
+                 - n_pairs - (carry != 0);
+    st->prev_cr = (carry != 0);
+
+    scan_block_scalar(in, len & 7, st);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ subst_block_runs() - Replace every byte from by the byte to.
+
+    memchr() skips to each byte to replace, so only those bytes are stored.
+ ------------------------------------------------------------------------------
+ */
+
+static void subst_block_runs(unsigned char *buf, size_t len,
+                             unsigned char from, unsigned char to)
+{
+    unsigned char *end = buf + len;
+
+    while(buf < end &&
+          (buf = memchr(buf, from, (size_t)(end - buf))) != NULL)
+    {
+        *buf++ = to;
+    }
+}
+
+#ifdef EOL_X86_KERNELS
+
+/*
+ ------------------------------------------------------------------------------
+ SIMD scan kernels.
+
+    The block is processed 64 bytes at a time.  Comparing against CR and LF
+    gives one bit per byte in the 64-bit masks cr and lf.  A CR+LF pair is an
+    LF whose bit is set in the CR mask shifted up by one, with the last CR of
+    the previous 64 bytes shifted in from below.  Each class is then counted
+    with a population count:
+
+        msdos = popcount(pairs)
+        unix  = popcount(lf) - popcount(pairs)
+        mac   = popcount(cr) - popcount(pairs)
+                + (CR carried in) - (CR pending at the end)
+
+    The bytes after the last full 64 bytes are handled by scan_block_scalar().
+ ------------------------------------------------------------------------------
+ */
+
+/*
+ SCAN_MASKS() - Add the counts for one 64-byte step to the totals.
+ */
+#define SCAN_MASKS(cr, lf, carry, n_pairs, n_lf, n_cr)                        \
+    do                                                                        \
+    {                                                                         \
+        uint64_t pairs = (lf) & (((cr) << 1) | (carry));                      \
+        (carry) = (cr) >> 63;                                                 \
+        (n_pairs) += __builtin_popcountll(pairs);                             \
+        (n_lf) += __builtin_popcountll(lf);                                   \
+        (n_cr) += __builtin_popcountll(cr);                                   \
+    } while(0)
+
+/*
+ scan_epilogue() - Store the totals of the 64-byte steps and scan the
+ remaining bytes.
+ */
+static void scan_epilogue(const unsigned char *in, size_t len,
+                          struct eol_counts *st, uint64_t carry,
+                          unsigned long n_pairs, unsigned long n_lf,
+                          unsigned long n_cr)
+{
+    st->cnt_msdos += n_pairs;
+    st->cnt_unix += n_lf - n_pairs;
+    st->cnt_mac += n_cr + (unsigned long)st->prev_cr
+                 - n_pairs - (unsigned long)carry;
+    st->prev_cr = (int)carry;
+
+    scan_block_scalar(in, len, st);
+}
+
+__attribute__((target("sse2")))
+static void scan_block_sse2(const unsigned char *in, size_t len,
+                            struct eol_counts *st)
+{
+    const __m128i v_cr = _mm_set1_epi8('\r');
+    const __m128i v_lf = _mm_set1_epi8('\n');
+    const unsigned char *end;
+    uint64_t cr, lf, carry = (uint64_t)st->prev_cr;
+    unsigned long n_pairs = 0, n_lf = 0, n_cr = 0;
+    __m128i v0, v1, v2, v3;
+
+    end = in + (len & ~(size_t)63);
+
+    for(; in < end; in += 64)
+    {
+        v0 = _mm_loadu_si128((const __m128i *)in);
+        v1 = _mm_loadu_si128((const __m128i *)(in + 16));
+        v2 = _mm_loadu_si128((const __m128i *)(in + 32));
+        v3 = _mm_loadu_si128((const __m128i *)(in + 48));
+
+        cr = (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v0, v_cr))
+           | (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v1, v_cr)) << 16
+           | (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v2, v_cr)) << 32
+           | (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v3, v_cr)) << 48;
+        lf = (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v0, v_lf))
+           | (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v1, v_lf)) << 16
+           | (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v2, v_lf)) << 32
+           | (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v3, v_lf)) << 48;
+
+        if((cr | lf | carry) == 0)
+        {
+            continue;
+        }
+
+        SCAN_MASKS(cr, lf, carry, n_pairs, n_lf, n_cr);
+    }
+
+    scan_epilogue(in, len & 63, st, carry, n_pairs, n_lf, n_cr);
+}
+
+__attribute__((target("avx2,popcnt")))
+static void scan_block_avx2(const unsigned char *in, size_t len,
+                            struct eol_counts *st)
+{
+    const __m256i v_cr = _mm256_set1_epi8('\r');
+    const __m256i v_lf = _mm256_set1_epi8('\n');
+    const unsigned char *end;
+    uint64_t cr, lf, carry = (uint64_t)st->prev_cr;
+    unsigned long n_pairs = 0, n_lf = 0, n_cr = 0;
+    __m256i v0, v1;
+
+    end = in + (len & ~(size_t)63);
+
+    for(; in < end; in += 64)
+    {
+        v0 = _mm256_loadu_si256((const __m256i *)in);
+        v1 = _mm256_loadu_si256((const __m256i *)(in + 32));
+
+        cr = (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, v_cr))
+           | (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, v_cr)) << 32;
+        lf = (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v0, v_lf))
+           | (uint64_t)(unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v1, v_lf)) << 32;
+
+        SCAN_MASKS(cr, lf, carry, n_pairs, n_lf, n_cr);
+    }
+
+    scan_epilogue(in, len & 63, st, carry, n_pairs, n_lf, n_cr);
+}
+
+__attribute__((target("avx512f,avx512bw,popcnt")))
+static void scan_block_avx512(const unsigned char *in, size_t len,
+                              struct eol_counts *st)
+{
+    const __m512i v_cr = _mm512_set1_epi8('\r');
+    const __m512i v_lf = _mm512_set1_epi8('\n');
+    const unsigned char *end;
+    uint64_t cr, lf, carry = (uint64_t)st->prev_cr;
+    unsigned long n_pairs = 0, n_lf = 0, n_cr = 0;
+    __m512i v;
+
+    end = in + (len & ~(size_t)63);
+
+    for(; in < end; in += 64)
+    {
+        v = _mm512_loadu_si512((const void *)in);
+
+        cr = _mm512_cmpeq_epi8_mask(v, v_cr);
+        lf = _mm512_cmpeq_epi8_mask(v, v_lf);
+
+        SCAN_MASKS(cr, lf, carry, n_pairs, n_lf, n_cr);
+    }
+
+    scan_epilogue(in, len & 63, st, carry, n_pairs, n_lf, n_cr);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ SSE2 set kernel.
+
+    The block is copied one vector at a time.  A vector without CR or LF is
+    stored to the output as it is.  Otherwise the bytes in front of the
+    first CR or LF are stored, and that line end is converted by
+    set_scalar().  The bytes after the last full vector are converted by
+    set_scalar().
+
+    A full vector is always stored, even when only the bytes in front of a
+    line end are kept.  This stays inside the output block, because the
+    output is at most twice the size of the input converted so far.
+ ------------------------------------------------------------------------------
+ */
+
+__attribute__((target("sse2")))
+static EOL_INLINE size_t set_sse2(const unsigned char *in, size_t len,
+                                  unsigned char *out,
+                                  struct eol_set_state *st, const int format)
+{
+    const __m128i v_cr = _mm_set1_epi8('\r');
+    const __m128i v_lf = _mm_set1_epi8('\n');
+    const unsigned char *end = in + len;
+    unsigned char *o = out;
+    unsigned int m, n;
+    __m128i v;
+
+    while(end - in >= 16)
+    {
+        v = _mm_loadu_si128((const __m128i *)in);
+        m = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, v_cr),
+                                                     _mm_cmpeq_epi8(v, v_lf)));
+        _mm_storeu_si128((__m128i *)o, v);
+
+        if(m == 0)
+        {
+            in += 16;
+            o += 16;
+            st->prev_cr = 0;
+            continue;
+        }
+
+        n = (unsigned)__builtin_ctz(m);
+        if(n > 0)
+        {
+            in += n;
+            o += n;
+            st->prev_cr = 0;
+        }
+
+        o += set_scalar(in, 1, o, st, format);
+        in++;
+    }
+
+    o += set_scalar(in, (size_t)(end - in), o, st, format);
+
+    return (size_t)(o - out);
+}
+
+SET_KERNELS(__attribute__((target("sse2"))), set_block_sse2, set_sse2)
+
+/*
+ ------------------------------------------------------------------------------
+ SIMD compaction kernels.
+
+    Converting to UNIX (LF) or Macintosh (CR) never makes the output longer:
+    every CR and every lone LF becomes one line end character, and the LF of
+    each CR+LF pair is dropped.  For each vector:
+
+        drop = lf & ((cr << 1) | CR carried in)
+
+    CR (for UNIX) or LF (for Macintosh) bytes are replaced by the line end
+    character with a blend, and the dropped bytes are removed 8 bytes at a
+    time with a byte shuffle from compact_shuffle[], indexed by the 8 drop
+    bits of those bytes.  Each 8-byte store is overwritten by the next one
+    except for the bytes that were kept.  With AVX-512 VBMI2, the dropped
+    bytes are removed from the whole 64-byte vector with VPCOMPRESSB.
+ ------------------------------------------------------------------------------
+ */
+
+__attribute__((target("avx2,popcnt")))
+static size_t compact_block_avx2(const unsigned char *in, size_t len,
+                                 unsigned char *out, struct eol_set_state *st)
+{
+    const __m256i v_cr = _mm256_set1_epi8('\r');
+    const __m256i v_lf = _mm256_set1_epi8('\n');
+    const __m256i v_eol = st->format == EOL_MAC ? v_cr : v_lf;
+    const __m128i v_lane1 = _mm_set1_epi8(8);
+    const unsigned char *end = in + (len & ~(size_t)31);
+    unsigned char *o = out;
+    uint32_t cr, lf, drop, carry = (uint32_t)st->prev_cr;
+    unsigned long nl = st->nl;
+    __m256i v, is_cr, is_lf;
+    __m128i h, shuf;
+    int k;
+
+    for(; in < end; in += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i *)in);
+        is_cr = _mm256_cmpeq_epi8(v, v_cr);
+        is_lf = _mm256_cmpeq_epi8(v, v_lf);
+        cr = (uint32_t)_mm256_movemask_epi8(is_cr);
+        lf = (uint32_t)_mm256_movemask_epi8(is_lf);
+
+        if((cr | lf) == 0)
+        {
+            _mm256_storeu_si256((__m256i *)o, v);
+            o += 32;
+            carry = 0;
+            continue;
+        }
+
+        drop = lf & ((cr << 1) | carry);
+        carry = cr >> 31;
+        nl += (unsigned long)(__builtin_popcount(cr) + __builtin_popcount(lf)
+                              - __builtin_popcount(drop));
+
+        /* Replace every CR and LF by the line end character. */
+        v = _mm256_blendv_epi8(v, v_eol, _mm256_or_si256(is_cr, is_lf));
+
+        if(drop == 0)
+        {
+            _mm256_storeu_si256((__m256i *)o, v);
+            o += 32;
+            continue;
+        }
+
+        /* Remove the dropped bytes, 8 bytes at a time. */
+        for(k = 0; k < 4; k++)
+        {
+            h = (k < 2) ? _mm256_castsi256_si128(v)
+                        : _mm256_extracti128_si256(v, 1);
+            shuf = _mm_loadl_epi64(
+                       (const __m128i *)compact_shuffle[(drop >> (8 * k)) & 0xff]);
+            if(k & 1)
+            {
+                shuf = _mm_add_epi8(shuf, v_lane1);
+            }
+            _mm_storel_epi64((__m128i *)o, _mm_shuffle_epi8(h, shuf));
+            o += 8 - __builtin_popcount((drop >> (8 * k)) & 0xff);
+        }
+    }
+
+    st->prev_cr = (int)carry;
+    st->nl = nl;
+
+    o += set_block_scalar(in, len & 31, o, st);
+
+    return (size_t)(o - out);
+}
+
+__attribute__((target("avx512f,avx512bw,avx512vbmi2,popcnt")))
+static size_t compact_block_avx512(const unsigned char *in, size_t len,
+                                   unsigned char *out,
+                                   struct eol_set_state *st)
+{
+    const __m512i v_cr = _mm512_set1_epi8('\r');
+    const __m512i v_lf = _mm512_set1_epi8('\n');
+    const __m512i v_eol = st->format == EOL_MAC ? v_cr : v_lf;
+    const unsigned char *end = in + (len & ~(size_t)63);
+    unsigned char *o = out;
+    uint64_t cr, lf, drop, carry = (uint64_t)st->prev_cr;
+    unsigned long nl = st->nl;
+    __m512i v;
+
+    for(; in < end; in += 64)
+    {
+        v = _mm512_loadu_si512((const void *)in);
+        cr = _mm512_cmpeq_epi8_mask(v, v_cr);
+        lf = _mm512_cmpeq_epi8_mask(v, v_lf);
+
+        drop = lf & ((cr << 1) | carry);
+        carry = cr >> 63;
+        nl += (unsigned long)(__builtin_popcountll(cr) +
+                              __builtin_popcountll(lf) -
+                              __builtin_popcountll(drop));
+
+        /* Replace every CR and LF by the line end character. */
+        v = _mm512_mask_blend_epi8(cr | lf, v, v_eol);
+
+        /* Remove the dropped bytes. */
+        if(drop != 0)
+        {
+            v = _mm512_maskz_compress_epi8(~drop, v);
+        }
+
+        _mm512_storeu_si512((void *)o, v);
+        o += 64 - __builtin_popcountll(drop);
+    }
+
+    st->prev_cr = (int)carry;
+    st->nl = nl;
+
+    o += set_block_scalar(in, len & 63, o, st);
+
+    return (size_t)(o - out);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ SIMD expansion kernel.
+
+    Converting to MS-DOS (CR+LF) can make the output up to twice as long: a
+    lone CR gets an LF after it and a lone LF gets a CR in front of it, while
+    CR+LF pairs are copied.  Looking one byte ahead, each vector has
+
+        expand = (cr & ~(LF after it)) | (lf & ~((cr << 1) | CR carried in))
+
+    and every byte whose expand bit is set becomes CR+LF.  Each group of 8
+    input bytes becomes 8 to 16 output bytes with one byte shuffle from
+    expand_shuffle[] and an OR with the CR+LF bytes in expand_eol[], both
+    indexed by the 8 expand bits of the group.
+
+    A CR at the end of the previous block was written as CR+LF, so an LF at
+    the start of this block is dropped, as in set_block_scalar().
+ ------------------------------------------------------------------------------
+ */
+
+__attribute__((target("avx2,popcnt")))
+static size_t expand_block_avx2(const unsigned char *in, size_t len,
+                                unsigned char *out, struct eol_set_state *st)
+{
+    const __m256i v_cr = _mm256_set1_epi8('\r');
+    const __m256i v_lf = _mm256_set1_epi8('\n');
+    const __m128i v_lane1 = _mm_set1_epi8(8);
+    const unsigned char *end = in + len;
+    unsigned char *o = out;
+    uint32_t cr, lf, next_lf, expand, m, carry = 0;
+    unsigned long nl = st->nl;
+    __m256i v;
+    __m128i h, shuf;
+    int k;
+
+    if(len == 0)
+    {
+        return 0;
+    }
+
+    /* Eat the LF of a CR+LF pair split between blocks. */
+    if(st->prev_cr && *in == '\n')
+    {
+        in++;
+    }
+    st->prev_cr = 0;
+
+    /* Stop one byte early, to look at the byte after each vector. */
+    while(end - in > 32)
+    {
+        v = _mm256_loadu_si256((const __m256i *)in);
+        cr = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, v_cr));
+        lf = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, v_lf));
+
+        if((cr | lf) == 0)
+        {
+            _mm256_storeu_si256((__m256i *)o, v);
+            in += 32;
+            o += 32;
+            carry = 0;
+            continue;
+        }
+
+        next_lf = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(
+                      _mm256_loadu_si256((const __m256i *)(in + 1)), v_lf));
+        expand = (cr & ~next_lf) | (lf & ~((cr << 1) | carry));
+        nl += (unsigned long)__builtin_popcount(cr) +
+              (unsigned long)__builtin_popcount(lf & ~((cr << 1) | carry));
+        carry = cr >> 31;
+
+        if(expand == 0)
+        {
+            _mm256_storeu_si256((__m256i *)o, v);
+            in += 32;
+            o += 32;
+            continue;
+        }
+
+        /* Expand the marked bytes to CR+LF, 8 input bytes at a time. */
+        for(k = 0; k < 4; k++)
+        {
+            m = (expand >> (8 * k)) & 0xff;
+            h = (k < 2) ? _mm256_castsi256_si128(v)
+                        : _mm256_extracti128_si256(v, 1);
+            shuf = _mm_loadu_si128((const __m128i *)expand_shuffle[m]);
+            if(k & 1)
+            {
+                shuf = _mm_add_epi8(shuf, v_lane1);
+            }
+            _mm_storeu_si128((__m128i *)o,
+                             _mm_or_si128(_mm_shuffle_epi8(h, shuf),
+                                          _mm_loadu_si128(
+                                              (const __m128i *)expand_eol[m])));
+            o += 8 + __builtin_popcount(m);
+        }
+
+        in += 32;
+    }
+
+    /*
+     A CR at the end of the last vector was written alone if the next byte is
+     an LF.  Copy that LF, so the scalar kernel starts after the pair.
+     */
+    if(carry && *in == '\n')
+    {
+        *o++ = '\n';
+        in++;
+    }
+
+    st->nl = nl;
+
+    o += set_block_scalar_msdos(in, (size_t)(end - in), o, st);
+
+    return (size_t)(o - out);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ SIMD substitution kernels.
+
+    Each vector is compared against the byte to replace.  A vector without
+    it is left alone.  Otherwise the replacement is blended in and the
+    vector is stored; AVX-512 stores only the replaced bytes.
+ ------------------------------------------------------------------------------
+ */
+
+__attribute__((target("sse2")))
+static void subst_block_sse2(unsigned char *buf, size_t len,
+                             unsigned char from, unsigned char to)
+{
+    const __m128i v_from = _mm_set1_epi8((char)from);
+    const __m128i v_to = _mm_set1_epi8((char)to);
+    unsigned char *end = buf + (len & ~(size_t)15);
+    __m128i v, m;
+
+    for(; buf < end; buf += 16)
+    {
+        v = _mm_loadu_si128((const __m128i *)buf);
+        m = _mm_cmpeq_epi8(v, v_from);
+
+        if(_mm_movemask_epi8(m) != 0)
+        {
+            v = _mm_or_si128(_mm_andnot_si128(m, v), _mm_and_si128(m, v_to));
+            _mm_storeu_si128((__m128i *)buf, v);
+        }
+    }
+
+    subst_block_runs(buf, len & 15, from, to);
+}
+
+__attribute__((target("avx2")))
+static void subst_block_avx2(unsigned char *buf, size_t len,
+                             unsigned char from, unsigned char to)
+{
+    const __m256i v_from = _mm256_set1_epi8((char)from);
+    const __m256i v_to = _mm256_set1_epi8((char)to);
+    unsigned char *end = buf + (len & ~(size_t)31);
+    __m256i v, m;
+
+    for(; buf < end; buf += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i *)buf);
+        m = _mm256_cmpeq_epi8(v, v_from);
+
+        if(_mm256_movemask_epi8(m) != 0)
+        {
+            _mm256_storeu_si256((__m256i *)buf, _mm256_blendv_epi8(v, v_to, m));
+        }
+    }
+
+    subst_block_runs(buf, len & 31, from, to);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static void subst_block_avx512(unsigned char *buf, size_t len,
+                               unsigned char from, unsigned char to)
+{
+    const __m512i v_from = _mm512_set1_epi8((char)from);
+    const __m512i v_to = _mm512_set1_epi8((char)to);
+    unsigned char *end = buf + (len & ~(size_t)63);
+    __mmask64 m;
+
+    for(; buf < end; buf += 64)
+    {
+        m = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512((const void *)buf),
+                                   v_from);
+
+        if(m != 0)
+        {
+            _mm512_mask_storeu_epi8((void *)buf, m, v_to);
+        }
+    }
+
+    subst_block_runs(buf, len & 63, from, to);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ SIMD find kernels.
+
+    Each vector is compared against CR and LF, and the first match is found
+    from the mask.  The bytes after the last full vector are searched by
+    find_eol().
+ ------------------------------------------------------------------------------
+ */
+
+__attribute__((target("sse2")))
+static const unsigned char *find_eol_sse2(const unsigned char *p,
+                                          const unsigned char *end)
+{
+    const __m128i v_cr = _mm_set1_epi8('\r');
+    const __m128i v_lf = _mm_set1_epi8('\n');
+    unsigned int m;
+    __m128i v;
+
+    for(; end - p >= 16; p += 16)
+    {
+        v = _mm_loadu_si128((const __m128i *)p);
+        m = (unsigned)_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, v_cr),
+                                                     _mm_cmpeq_epi8(v, v_lf)));
+
+        if(m != 0)
+        {
+            return p + __builtin_ctz(m);
+        }
+    }
+
+    return find_eol(p, end);
+}
+
+__attribute__((target("avx2")))
+static const unsigned char *find_eol_avx2(const unsigned char *p,
+                                          const unsigned char *end)
+{
+    const __m256i v_cr = _mm256_set1_epi8('\r');
+    const __m256i v_lf = _mm256_set1_epi8('\n');
+    unsigned int m;
+    __m256i v;
+
+    for(; end - p >= 32; p += 32)
+    {
+        v = _mm256_loadu_si256((const __m256i *)p);
+        m = (unsigned)_mm256_movemask_epi8(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, v_cr),
+                                _mm256_cmpeq_epi8(v, v_lf)));
+
+        if(m != 0)
+        {
+            return p + __builtin_ctz(m);
+        }
+    }
+
+    return find_eol(p, end);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static const unsigned char *find_eol_avx512(const unsigned char *p,
+                                            const unsigned char *end)
+{
+    const __m512i v_cr = _mm512_set1_epi8('\r');
+    const __m512i v_lf = _mm512_set1_epi8('\n');
+    __mmask64 m;
+    __m512i v;
+
+    for(; end - p >= 64; p += 64)
+    {
+        v = _mm512_loadu_si512((const void *)p);
+        m = _mm512_cmpeq_epi8_mask(v, v_cr) | _mm512_cmpeq_epi8_mask(v, v_lf);
+
+        if(m != 0)
+        {
+            return p + __builtin_ctzll(m);
+        }
+    }
+
+    return find_eol(p, end);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ init_kernel_tables() - Fill in the tables used by the SIMD kernels.
+
+    compact_shuffle[m] lists, in order, the indexes of the bytes of an 8-byte
+    group that are kept when the bits set in m are dropped.
+
+    expand_shuffle[m] lists the indexes of the bytes of an 8-byte group, with
+    two zero bytes in place of each byte whose bit is set in m.  expand_eol[m]
+    has CR+LF in those two bytes and zero elsewhere.
+ ------------------------------------------------------------------------------
+ */
+
+static void init_kernel_tables(void)
+{
+    int m, i, n;
+
+    for(m = 0; m < 256; m++)
+    {
+        n = 0;
+        for(i = 0; i < 8; i++)
+        {
+            if((m & (1 << i)) == 0)
+            {
+                compact_shuffle[m][n++] = (unsigned char)i;
+            }
+        }
+        while(n < 8)
+        {
+            compact_shuffle[m][n++] = 0x80;
+        }
+    }
+
+    for(m = 0; m < 256; m++)
+    {
+        n = 0;
+        for(i = 0; i < 8; i++)
+        {
+            if(m & (1 << i))
+            {
+                expand_shuffle[m][n] = 0x80;
+                expand_eol[m][n++] = '\r';
+                expand_shuffle[m][n] = 0x80;
+                expand_eol[m][n++] = '\n';
+            }
+            else
+            {
+                expand_shuffle[m][n] = (unsigned char)i;
+                expand_eol[m][n++] = 0;
+            }
+        }
+        while(n < 16)
+        {
+            expand_shuffle[m][n] = 0x80;
+            expand_eol[m][n++] = 0;
+        }
+    }
+
+    __builtin_cpu_init();
+    cpu_has_vbmi2 = __builtin_cpu_supports("avx512vbmi2");
+
+    /* Without VBMI2 the AVX-512 set compacts with the AVX2 kernel. */
+    if(!cpu_has_vbmi2)
+    {
+        eol_kernels[EOL_KERNEL_COUNT - 1].set[EOL_UNIX] = compact_block_avx2;
+        eol_kernels[EOL_KERNEL_COUNT - 1].set[EOL_MAC] = compact_block_avx2;
+    }
+}
+
+#endif /* EOL_X86_KERNELS */
+
+/*
+ ------------------------------------------------------------------------------
+ kernel_supported() - Check that the CPU can run a kernel set.
+ ------------------------------------------------------------------------------
+ */
+
+static int kernel_supported(struct eol_kernel *k)
+{
+    if(k->cpu_feature == 0)
+    {
+        return 1;
+    }
+
+#ifdef EOL_X86_KERNELS
+    __builtin_cpu_init();
+
+    if(strcmp(k->cpu_feature, "sse2") == 0)
+    {
+        return __builtin_cpu_supports("sse2");
+    }
+    if(strcmp(k->cpu_feature, "avx2") == 0)
+    {
+        return __builtin_cpu_supports("avx2") &&
+               __builtin_cpu_supports("popcnt");
+    }
+    if(strcmp(k->cpu_feature, "avx512") == 0)
+    {
+        return __builtin_cpu_supports("avx512f") &&
+               __builtin_cpu_supports("avx512bw") &&
+               __builtin_cpu_supports("popcnt");
+    }
+#endif /* EOL_X86_KERNELS */
+
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_select_kernels() - Choose the kernels of all contexts.
+
+    With no name, the fastest kernel set this CPU supports is used, with
+    the run kernels for sparse line ends.  A named kernel set is always
+    used as it is.  Returns 0, or -1 if the named kernel set is unknown or
+    not supported.  The kernels are shared by all contexts, so this must be
+    called before any context exists, and not while other threads use the
+    library.
+ ------------------------------------------------------------------------------
+ */
+
+int eol_select_kernels(const char *name)
+{
+    int i;
+
+#ifdef EOL_X86_KERNELS
+    EOL_ONCE(tables_once, init_kernel_tables);
+#endif /* EOL_X86_KERNELS */
+
+    for(i = (int)EOL_KERNEL_COUNT - 1; i >= 0; i--)
+    {
+        if(name != 0 && strcmp(name, eol_kernels[i].name) != 0)
+        {
+            continue;
+        }
+
+        if(kernel_supported(&eol_kernels[i]))
+        {
+            kernel = &eol_kernels[i];
+            kernel_pinned = (name != 0);
+            kernel_selected = 1;
+            return 0;
+        }
+
+        if(name != 0)
+        {
+            break;
+        }
+    }
+
+    return -1;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ need_kernels() - Choose the default kernels, unless some were chosen.
+
+    Called by every function that uses the kernels, so that contexts made
+    on several threads at once choose them only once.
+ ------------------------------------------------------------------------------
+ */
+
+static void select_default_kernels(void)
+{
+    if(!kernel_selected)
+    {
+        eol_select_kernels(0);
+    }
+}
+
+static void need_kernels(void)
+{
+    EOL_ONCE(kernels_once, select_default_kernels);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_selected_kernels(), eol_kernel_list() - Names of the kernel sets.
+
+    eol_selected_kernels() names the kernel set of all contexts.
+    eol_kernel_list() names the i-th kernel set this CPU supports, or
+    returns 0 past the last one.
+ ------------------------------------------------------------------------------
+ */
+
+const char *eol_selected_kernels(void)
+{
+    need_kernels();
+
+    return kernel->name;
+}
+
+const char *eol_kernel_list(int i)
+{
+    int k;
+
+    for(k = 0; k < (int)EOL_KERNEL_COUNT; k++)
+    {
+        if(kernel_supported(&eol_kernels[k]) && i-- == 0)
+        {
+            return eol_kernels[k].name;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ mean_line_length() - Estimate the mean line length of a file.
+
+    Counts the line ends in the first EOL_SAMPLE_SIZE bytes of buf.
+ ------------------------------------------------------------------------------
+ */
+
+static unsigned long mean_line_length(const unsigned char *buf, size_t len)
+{
+    struct eol_counts st;
+
+    if(len > EOL_SAMPLE_SIZE)
+    {
+        len = EOL_SAMPLE_SIZE;
+    }
+
+    memset(&st, 0, sizeof(st));
+    kernel->scan(buf, len, &st);
+
+    return (unsigned long)len /
+           (st.cnt_msdos + st.cnt_mac + st.cnt_unix + st.prev_cr + 1);
+}
+
+/*
+ ------------------------------------------------------------------------------
+ choose_scan_kernel(), choose_set_kernel() - Choose the kernel for a text.
+
+    buf is the first text fed to a context.  Sparse line ends are skipped
+    faster by the run kernels, and dense ones are counted or converted
+    faster by the kernels of the selected set.  A kernel set named to
+    eol_select_kernels() is always used as it is.  *name is set to the name
+    of the kernels chosen.
+ ------------------------------------------------------------------------------
+ */
+
+static scan_kernel_fn choose_scan_kernel(const unsigned char *buf, size_t len,
+                                         const char **name)
+{
+    *name = kernel->name;
+
+    if(kernel_pinned || kernel->scan_sparse == 0)
+    {
+        return kernel->scan;
+    }
+
+    if(mean_line_length(buf, len) >= kernel->scan_sparse)
+    {
+        *name = "runs";
+        return scan_block_runs;
+    }
+
+    return kernel->scan;
+}
+
+static set_kernel_fn choose_set_kernel(const unsigned char *buf, size_t len,
+                                       int format, const char **name)
+{
+    *name = kernel->name;
+
+    if(kernel_pinned || kernel->set_sparse == 0)
+    {
+        return kernel->set[format];
+    }
+
+    if(mean_line_length(buf, len) >= kernel->set_sparse)
+    {
+        *name = "runs";
+        return EOL_RUN_KERNELS->set[format];
+    }
+
+    return kernel->set[format];
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_tuning_path() - Name of the file that holds the eol_autotune() results.
+
+    $EOL_AUTOTUNE_FILE, or .eol_autotune in the home directory.
+    Returns 0 if neither is set.
+ ------------------------------------------------------------------------------
+ */
+
+const char *eol_tuning_path(void)
+{
+    static char path[512];
+    char *env;
+
+    env = getenv("EOL_AUTOTUNE_FILE");
+    if(env != 0 && env[0] != '\0')
+    {
+        return env;
+    }
+
+    env = getenv("HOME");
+    if(env == 0 || strlen(env) + sizeof("/.eol_autotune") > sizeof(path))
+    {
+        return 0;
+    }
+
+    strcpy(path, env);
+    strcat(path, "/.eol_autotune");
+
+    return path;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_load_tuning() - Read the thresholds saved by eol_autotune().
+
+    Each line of the file holds a kernel set name and its scan_sparse and
+    set_sparse thresholds.  Only the line for the selected set is used.
+    Returns 0 if it was found, -1 otherwise.  The thresholds are shared by
+    all contexts, so this must be called before any context exists, and not
+    while other threads use the library.
+ ------------------------------------------------------------------------------
+ */
+
+int eol_load_tuning(const char *path)
+{
+    FILE *f;
+    char line[128];
+    char name[32];
+    unsigned long scan_sparse, set_sparse;
+    int found = -1;
+
+    need_kernels();
+
+    if(path == 0 || (f = fopen(path, "r")) == NULL)
+    {
+        return -1;
+    }
+
+    while(fgets(line, sizeof(line), f) != NULL)
+    {
+        if(line[0] == '#')
+        {
+            continue;
+        }
+
+        if(sscanf(line, "%31s %lu %lu", name, &scan_sparse, &set_sparse) == 3 &&
+           strcmp(name, kernel->name) == 0)
+        {
+            kernel->scan_sparse = scan_sparse;
+            kernel->set_sparse = set_sparse;
+            found = 0;
+        }
+    }
+
+    fclose(f);
+
+    return found;
+}
+
+/*
+ ------------------------------------------------------------------------------
+ eol_autotune() - Measure where the run kernels become faster on this
+                  machine.
+
+    Text with every line the same length is scanned and set to UNIX with
+    the kernels of the selected set and with the run kernels, for lines of
+    8 bytes to 64 KiB.  The threshold is the shortest line length from which
+    the run kernels are faster for every longer line length measured, or 0
+    if they are not faster for the longest lines.  The thresholds are
+    stored in path for later runs, and reported on stderr.
+    Returns 0, or -1 on error.  Like eol_load_tuning(), this must be called
+    before any context exists, and not while other threads use the library.
+ ------------------------------------------------------------------------------
+ */
+
+#define EOL_TUNE_SIZE (1024 * 1024)
+#define EOL_TUNE_LONGEST (64 * 1024)
+
+static double time_scan(scan_kernel_fn scan, const unsigned char *buf,
+                        size_t len)
+{
+    struct eol_counts st;
+    clock_t start = clock();
+    clock_t elapsed;
+    long runs = 0;
+
+    do
+    {
+        memset(&st, 0, sizeof(st));
+        scan(buf, len, &st);
+        runs++;
+        elapsed = clock() - start;
+    } while(elapsed < CLOCKS_PER_SEC / 50);
+
+    return (double)elapsed / (double)runs;
+}
+
+static double time_set(set_kernel_fn set, const unsigned char *buf,
+                       size_t len, unsigned char *out)
+{
+    struct eol_set_state st;
+    clock_t start = clock();
+    clock_t elapsed;
+    long runs = 0;
+
+    do
+    {
+        st.format = EOL_UNIX;
+        st.prev_cr = 0;
+        st.nl = 0L;
+        set(buf, len, out, &st);
+        runs++;
+        elapsed = clock() - start;
+    } while(elapsed < CLOCKS_PER_SEC / 50);
+
+    return (double)elapsed / (double)runs;
+}
+
+int eol_autotune(const char *path)
+{
+    unsigned char *buf, *out;
+    unsigned long line;
+    unsigned long scan_sparse = 0, set_sparse = 0;
+    int scan_faster = 1, set_faster = 1;
+    size_t i;
+    FILE *f;
+
+    need_kernels();
+
+    buf = malloc(EOL_TUNE_SIZE);
+    out = malloc(2 * EOL_TUNE_SIZE);
+    if(buf == 0 || out == 0)
+    {
+        free(buf);
+        free(out);
+        fprintf(stderr, "Error: Not enough memory to autotune.\n");
+        return -1;
+    }
+
+    /* From the longest lines down, while the run kernels stay faster. */
+    for(line = EOL_TUNE_LONGEST; line >= 8 && (scan_faster || set_faster);
+        line /= 2)
+    {
+        for(i = 0; i < EOL_TUNE_SIZE; i++)
+        {
+            buf[i] = (i % line == line - 1) ? '\n' : 'x';
+        }
+
+        if(scan_faster &&
+           (scan_faster = time_scan(scan_block_runs, buf, EOL_TUNE_SIZE) <
+                          time_scan(kernel->scan, buf, EOL_TUNE_SIZE)))
+        {
+            scan_sparse = line;
+        }
+
+        if(set_faster &&
+           (set_faster = time_set(EOL_RUN_KERNELS->set[EOL_UNIX], buf,
+                                  EOL_TUNE_SIZE, out) <
+                         time_set(kernel->set[EOL_UNIX], buf,
+                                  EOL_TUNE_SIZE, out)))
+        {
+            set_sparse = line;
+        }
+    }
+
+    free(buf);
+    free(out);
+
+    kernel->scan_sparse = scan_sparse;
+    kernel->set_sparse = set_sparse;
+
+    fprintf(stderr,
+            "Autotune: %s kernels, run kernels used from a mean line length of\n"
+            "          scan: %lu bytes, set: %lu bytes (0 is never).\n",
+            kernel->name, scan_sparse, set_sparse);
+
+    if(path == 0 || (f = fopen(path, "w")) == NULL)
+    {
+        fprintf(stderr,
+                "Error: Cannot save autotune results to %s.\n"
+                "       Reason: %s.\n",
+                path ? path : "$HOME/.eol_autotune",
+                path ? strerror(errno) : "HOME is not set");
+        return -1;
+    }
+
+    fprintf(f, "# eol --autotune: kernel scan_sparse set_sparse\n");
+    fprintf(f, "%s %lu %lu\n", kernel->name, scan_sparse, set_sparse);
+    fclose(f);
+
+    return 0;
+}
+
+/* ************************************************************************* */
+/* end of libeol.c */